@@ -46,6 +46,27 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 extern "C" {
 #endif
 
+/*
+ * Allocation of task objects. Memory returned by hclib_task_alloc is zeroed,
+ * and tasks are released by the runtime with hclib_task_free once they have
+ * executed.
+ */
+extern void *hclib_task_alloc(size_t nbytes);
+extern void hclib_task_free(void *task);
+
+/*
+ * Largest request hclib_task_alloc serves from a worker's slab, i.e. the size of
+ * a slab block less its header. Larger ones go to the system allocator.
+ */
+#define HCLIB_TASK_SLAB_PAYLOAD_SIZE 240
+
+/*
+ * Same for other runtime objects (shared promises, dependency sets), which are
+ * kept apart from tasks since waiters may still look at a completed task.
+ */
+extern void *hclib_object_alloc(size_t nbytes);
+extern void hclib_object_free(void *object);
+
 extern void spawn(hclib_task_t * task);
 extern void spawn_await_at(hclib_task_t *task, hclib_future_t **futures,
         const int nfutures, hclib_locale_t *locale);
@@ -53,6 +74,14 @@ extern void spawn_at(hclib_task_t *task, hclib_locale_t *locale);
 extern void spawn_await(hclib_task_t *task, hclib_future_t **futures,
         const int nfutures);
 
+/*
+ * Record that task, which waits on no futures and has not been spawned yet,
+ * is the one that will satisfy promise. A task waiting on promise may then run
+ * it inline if it has not started yet, see hclib_future_wait.
+ */
+extern void hclib_task_set_producer(hclib_task_t *task,
+        hclib_promise_t *promise);
+
 #ifdef __cplusplus
 }
 #endif
@@ -36,6 +36,9 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 #include <functional>
 #include <vector>
+#include <new>
+#include <type_traits>
+#include <utility>
 
 #include "hclib.h"
 #include "hclib-async-struct.h"
@@ -51,32 +54,55 @@ namespace hclib {
  * The C API to the HC runtime defines a task at its simplest as a function
  * pointer paired with a void* pointing to some user data. This file adds a C++
  * wrapper over that API by passing the C API a lambda-caller function and a
- * pointer to the lambda stored on the heap, which are then called.
+ * pointer to the lambda, which are then called.
  *
- * This does add more overheads in the C++ version (i.e. memory allocations).
- * TODO optimize that overhead.
+ * To keep spawning cheap, the task, its async_arguments and the lambda are
+ * carved out of a single allocation. Lambdas whose closure is larger than
+ * HCLIB_TASK_INLINE_CLOSURE_SIZE bytes are stored on the heap instead. By
+ * default that is whatever room the task and its async_arguments (two
+ * pointers) leave in a slab block.
  */
 
+#ifndef HCLIB_TASK_INLINE_CLOSURE_SIZE
+#define HCLIB_TASK_INLINE_CLOSURE_SIZE (HCLIB_TASK_SLAB_PAYLOAD_SIZE - \
+        sizeof(hclib_task_t) - 2 * sizeof(void *))
+#endif
+
 /*
  * At the lowest layer in the call stack before entering user code, this method
  * invokes the user-provided lambda.
  */
 template <typename T>
 inline void call_lambda(T* lambda) {
-	const int wid = current_ws()->id;
-	MARK_BUSY(wid);
+	MARK_BUSY(current_ws()->id);
 	(*lambda)();
     delete lambda;
-	MARK_OVH(wid);
+	MARK_OVH(current_ws()->id);
 }
 
 /*
- * Call a lambda and place the output into a promise object.
+ * Same as call_lambda, for lambdas stored inline in their task. The storage is
+ * released along with the task.
+ */
+template <typename T>
+inline void call_inline_lambda(T* lambda) {
+	MARK_BUSY(current_ws()->id);
+	(*lambda)();
+    lambda->~T();
+	MARK_OVH(current_ws()->id);
+}
+
+/*
+ * Call a lambda and place the output into a promise object. Results too large
+ * for the promise's datum are moved into storage inside the promise rather
+ * than boxed on the heap, see promise_value_t. The promise is a shared one,
+ * and we then drop the reference held for this put.
  */
 template <typename T, typename R>
 struct call_and_put_wrapper {
     static void fn(T lambda, hclib::promise_t<R> *event) {
         event->put(lambda());
+        hclib::release_future(event->get_future());
     }
 };
 
@@ -88,6 +114,7 @@ struct call_and_put_wrapper<T, void> {
     static void fn(T lambda, hclib::promise_t<void> *event) {
         lambda();
         event->put();
+        hclib::release_future(event->get_future());
     }
 };
 
@@ -119,41 +146,91 @@ void lambda_wrapper(void *args) {
     (*a->lambda_caller)(a->lambda_on_heap);
 }
 
+/*
+ * Layout of a C++ task. The async_arguments live in the same allocation as the
+ * task, and so does the lambda if it is small enough (see lambda_task_factory).
+ */
+template<typename Function, typename T1>
+struct lambda_task_t {
+    hclib_task_t task;
+    async_arguments<Function, T1> args;
+};
+
+template<typename T>
+struct inline_lambda_task_t {
+    lambda_task_t<void (*)(T *), T> base;
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type lambda;
+};
+
+// Closures that are stored inline must still be served from a slab
+struct largest_inline_closure_t {
+    char bytes[HCLIB_TASK_INLINE_CLOSURE_SIZE];
+} __attribute__((aligned(sizeof(void *))));
+HASSERT_STATIC(sizeof(inline_lambda_task_t<largest_inline_closure_t>) <=
+        HCLIB_TASK_SLAB_PAYLOAD_SIZE,
+        "HCLIB_TASK_INLINE_CLOSURE_SIZE closures do not fit a task slab block");
+
 /*
  * Initialize a task_t for the C++ APIs, using a user-provided lambda.
  */
 template<typename Function, typename T1>
 inline hclib_task_t *initialize_task(Function lambda_caller, T1 *lambda_on_heap) {
-    hclib_task_t *t = (hclib_task_t *)calloc(1, sizeof(*t));
-    assert(t && lambda_on_heap);
-    async_arguments<Function, T1> *args =
-        new async_arguments<Function, T1>(lambda_caller, lambda_on_heap);
-    t->_fp = lambda_wrapper<Function, T1>;
-    t->args = args;
-    return t;
+    lambda_task_t<Function, T1> *t = (lambda_task_t<Function, T1> *)
+        hclib_task_alloc(sizeof(*t));
+    assert(lambda_on_heap);
+    new (&t->args) async_arguments<Function, T1>(lambda_caller, lambda_on_heap);
+    t->task._fp = lambda_wrapper<Function, T1>;
+    t->task.args = &t->args;
+    return &t->task;
+}
+
+template <typename T, bool fits_inline = (sizeof(T) <=
+        HCLIB_TASK_INLINE_CLOSURE_SIZE && alignof(T) <= alignof(void *) * 2)>
+struct lambda_task_factory {
+    template <typename L>
+    static hclib_task_t *create(L&& lambda) {
+        inline_lambda_task_t<T> *t = (inline_lambda_task_t<T> *)
+            hclib_task_alloc(sizeof(*t));
+        T *stored = new (&t->lambda) T(std::forward<L>(lambda));
+        new (&t->base.args) async_arguments<void (*)(T *), T>(
+                call_inline_lambda<T>, stored);
+        t->base.task._fp = lambda_wrapper<void (*)(T *), T>;
+        t->base.task.args = &t->base.args;
+        return &t->base.task;
+    }
+};
+
+template <typename T>
+struct lambda_task_factory<T, false> {
+    template <typename L>
+    static hclib_task_t *create(L&& lambda) {
+        return initialize_task(call_lambda<T>, new T(std::forward<L>(lambda)));
+    }
+};
+
+/*
+ * Create a task that will run a copy of lambda (or lambda itself, moved, if
+ * passed an rvalue).
+ */
+template <typename T>
+inline hclib_task_t *allocate_lambda_task(T&& lambda) {
+    typedef typename std::decay<T>::type U;
+    return lambda_task_factory<U>::create(std::forward<T>(lambda));
 }
 
 /*
- * lambda_on_heap is expected to be off-stack storage for a lambda object
- * (including its captured variables), which will be pointed to from the task_t.
+ * Create a task running a copy of the lambda object pointed to by lambda.
  */
 template <typename T>
 inline hclib_task_t* _allocate_async(T *lambda) {
-    // create off-stack storage for this task
-    T *lambda_on_heap = (T *)malloc(sizeof(*lambda_on_heap));
-    assert(lambda_on_heap);
-    memcpy(lambda_on_heap, lambda, sizeof(*lambda_on_heap));
-
-    hclib_task_t *task = initialize_task(call_lambda<T>, lambda_on_heap);
-	return task;
+    return allocate_lambda_task(*lambda);
 }
 
 template <typename T>
 inline void async_await_at_helper(T&& lambda, hclib_future_t **futures,
         const int nfutures, hclib_locale_t *locale, const int non_blocking) {
     MARK_OVH(current_ws()->id);
-    typedef typename std::remove_reference<T>::type U;
-    hclib_task_t* task = initialize_task(call_lambda<U>, new U(lambda));
+    hclib_task_t* task = allocate_lambda_task(std::forward<T>(lambda));
     task->non_blocking = non_blocking;
     spawn_await_at(task, futures, nfutures, locale);
 }
@@ -161,22 +238,42 @@ inline void async_await_at_helper(T&& lambda, hclib_future_t **futures,
 template <typename T>
 inline void async(T &&lambda) {
 	MARK_OVH(current_ws()->id);
-    typedef typename std::remove_reference<T>::type U;
-    spawn(initialize_task(call_lambda<U>, new U(lambda)));
+    spawn(allocate_lambda_task(std::forward<T>(lambda)));
 }
 
 template <typename T>
 inline void async_at(T&& lambda, hclib_locale_t *locale) {
     MARK_OVH(current_ws()->id);
-    typedef typename std::remove_reference<T>::type U;
-    spawn_at(initialize_task(call_lambda<U>, new U(lambda)), locale);
+    spawn_at(allocate_lambda_task(std::forward<T>(lambda)), locale);
+}
+
+/*
+ * Variants of async and async_await_at for tasks that should run ahead of
+ * others. priority ranges from HCLIB_PRIORITY_DEFAULT to HCLIB_PRIORITY_MAX.
+ */
+template <typename T>
+inline void async_with_priority(const int priority, T&& lambda) {
+    assert(priority >= HCLIB_PRIORITY_DEFAULT && priority <= HCLIB_PRIORITY_MAX);
+    MARK_OVH(current_ws()->id);
+    hclib_task_t *task = allocate_lambda_task(std::forward<T>(lambda));
+    task->priority = priority;
+    spawn(task);
+}
+
+template <typename T>
+inline void async_await_at_with_priority(const int priority, T&& lambda,
+        hclib_future_t *future, hclib_locale_t *locale) {
+    assert(priority >= HCLIB_PRIORITY_DEFAULT && priority <= HCLIB_PRIORITY_MAX);
+    MARK_OVH(current_ws()->id);
+    hclib_task_t *task = allocate_lambda_task(std::forward<T>(lambda));
+    task->priority = priority;
+    spawn_await_at(task, future ? &future : NULL, future ? 1 : 0, locale);
 }
 
 template <typename T>
 inline void async_nb(T&& lambda) {
 	MARK_OVH(current_ws()->id);
-    typedef typename std::remove_reference<T>::type U;
-    hclib_task_t *task = initialize_task(call_lambda<U>, new U(lambda));
+    hclib_task_t *task = allocate_lambda_task(std::forward<T>(lambda));
     task->non_blocking = 1;
 	spawn(task);
 }
@@ -184,8 +281,7 @@ inline void async_nb(T&& lambda) {
 template <typename T>
 inline void async_nb_at(T&& lambda, hclib_locale_t *locale) {
 	MARK_OVH(current_ws()->id);
-    typedef typename std::remove_reference<T>::type U;
-    hclib_task_t *task = initialize_task(call_lambda<U>, new U(lambda));
+    hclib_task_t *task = allocate_lambda_task(std::forward<T>(lambda));
     task->non_blocking = 1;
 	spawn_at(task, locale);
 }
@@ -193,8 +289,7 @@ inline void async_nb_at(T&& lambda, hclib_locale_t *locale) {
 template <typename T>
 inline void async_nb_await(T&& lambda, hclib_future_t *future) {
 	MARK_OVH(current_ws()->id);
-    typedef typename std::remove_reference<T>::type U;
-	hclib_task_t* task = initialize_task(call_lambda<U>, new U(lambda));
+	hclib_task_t* task = allocate_lambda_task(std::forward<T>(lambda));
     task->non_blocking = 1;
 	spawn_await(task, future ? &future : NULL, future ? 1 : 0);
 }
@@ -213,8 +308,7 @@ template <typename T>
 inline void async_nb_await_at(T&& lambda, hclib_future_t *fut,
         hclib_locale_t *locale) {
     MARK_OVH(current_ws()->id);
-    typedef typename std::remove_reference<T>::type U;
-    hclib_task_t *task = initialize_task(call_lambda<U>, new U(lambda));
+    hclib_task_t *task = allocate_lambda_task(std::forward<T>(lambda));
     task->non_blocking = 1;
     spawn_await_at(task, fut ? &fut : NULL, fut ? 1 : 0, locale);
 }
@@ -247,8 +341,7 @@ inline void async_nb_await(T&& lambda, std::vector<hclib_future_t *> *futures) {
 template <typename T>
 inline void async_await(T&& lambda, hclib_future_t *future) {
 	MARK_OVH(current_ws()->id);
-    typedef typename std::remove_reference<T>::type U;
-    hclib_task_t* task = initialize_task(call_lambda<U>, new U(lambda));
+    hclib_task_t* task = allocate_lambda_task(std::forward<T>(lambda));
 	spawn_await(task, future ? &future : NULL, future ? 1 : 0);
 }
 
@@ -256,8 +349,7 @@ template <typename T>
 inline void async_await(T&& lambda, hclib_future_t *future1,
         hclib_future_t *future2) {
 	MARK_OVH(current_ws()->id);
-    typedef typename std::remove_reference<T>::type U;
-    hclib_task_t* task = initialize_task(call_lambda<U>, new U(lambda));
+    hclib_task_t* task = allocate_lambda_task(std::forward<T>(lambda));
 
     int nfutures = 0;
     hclib_future_t *futures[2];
@@ -276,8 +368,7 @@ inline void async_await(T&& lambda, hclib_future_t *future1,
         hclib_future_t *future2, hclib_future_t *future3,
         hclib_future_t *future4) {
 	MARK_OVH(current_ws()->id);
-    typedef typename std::remove_reference<T>::type U;
-    hclib_task_t* task = initialize_task(call_lambda<U>, new U(lambda));
+    hclib_task_t* task = allocate_lambda_task(std::forward<T>(lambda));
 
     int nfutures = 0;
     hclib_future_t *futures[4];
@@ -309,8 +400,7 @@ template <typename T>
 inline void async_await_at(T&& lambda, hclib_future_t *future,
         hclib_locale_t *locale) {
 	MARK_OVH(current_ws()->id);
-    typedef typename std::remove_reference<T>::type U;
-    hclib_task_t* task = initialize_task(call_lambda<U>, new U(lambda));
+    hclib_task_t* task = allocate_lambda_task(std::forward<T>(lambda));
 	spawn_await_at(task, future ? &future : NULL, future ? 1 : 0,
             locale);
 }
@@ -319,8 +409,7 @@ template <typename T>
 inline void async_await_at(T&& lambda, hclib_future_t *future1,
         hclib_future_t *future2, hclib_locale_t *locale) {
 	MARK_OVH(current_ws()->id);
-    typedef typename std::remove_reference<T>::type U;
-    hclib_task_t* task = initialize_task(call_lambda<U>, new U(lambda));
+    hclib_task_t* task = allocate_lambda_task(std::forward<T>(lambda));
 
     int nfutures = 0;
     hclib_future_t *futures[2];
@@ -360,7 +449,7 @@ auto async_future_await_at_helper(T&& lambda, hclib_future_t **futures,
     MARK_OVH(current_ws()->id);
     typedef decltype(lambda()) R;
 
-    hclib::promise_t<R> *event = new hclib::promise_t<R>();
+    hclib::promise_t<R> *event = hclib::make_shared_promise<R>(2);
     /*
      * TODO creating this closure may be inefficient. While the capture list is
      * precise, if the user-provided lambda is large then copying it by value
@@ -369,19 +458,22 @@ auto async_future_await_at_helper(T&& lambda, hclib_future_t **futures,
     auto wrapper = [event, lambda]() {
         call_and_put_wrapper<T, R>::fn(lambda, event);
     };
-    typedef decltype(wrapper) U;
-
-    hclib_task_t* task = initialize_task(call_lambda<U>, new U(wrapper));
+    hclib_task_t* task = allocate_lambda_task(std::move(wrapper));
     task->non_blocking = non_blocking;
     spawn_await_at(task, futures, nfutures, locale);
     return event->get_future();
 }
 
+/*
+ * The caller owns a reference to the returned future, and the promise behind it
+ * is released once that reference is dropped (see future_ref_t) and the result
+ * was put on it.
+ */
 template <typename T>
 auto async_future(T&& lambda) -> hclib::future_t<decltype(lambda())>* {
     typedef decltype(lambda()) R;
 
-    hclib::promise_t<R> *event = new hclib::promise_t<R>();
+    hclib::promise_t<R> *event = hclib::make_shared_promise<R>(2);
     /*
      * TODO creating this closure may be inefficient. While the capture list is
      * precise, if the user-provided lambda is large then copying it by value
@@ -390,9 +482,8 @@ auto async_future(T&& lambda) -> hclib::future_t<decltype(lambda())>* {
     auto wrapper = [event, lambda]() {
         call_and_put_wrapper<T, R>::fn(lambda, event);
     };
-    typedef decltype(wrapper) U;
-
-    hclib_task_t* task = initialize_task(call_lambda<U>, new U(wrapper));
+    hclib_task_t* task = allocate_lambda_task(std::move(wrapper));
+    hclib_task_set_producer(task, event);
     spawn(task);
     return event->get_future();
 }
@@ -401,7 +492,7 @@ template <typename T>
 auto async_nb_future(T&& lambda) -> hclib::future_t<decltype(lambda())>* {
     typedef decltype(lambda()) R;
 
-    hclib::promise_t<R> *event = new hclib::promise_t<R>();
+    hclib::promise_t<R> *event = hclib::make_shared_promise<R>(2);
     /*
      * TODO creating this closure may be inefficient. While the capture list is
      * precise, if the user-provided lambda is large then copying it by value
@@ -410,10 +501,9 @@ auto async_nb_future(T&& lambda) -> hclib::future_t<decltype(lambda())>* {
     auto wrapper = [event, lambda]() {
         call_and_put_wrapper<T, R>::fn(lambda, event);
     };
-    typedef decltype(wrapper) U;
-
-    hclib_task_t* task = initialize_task(call_lambda<U>, new U(wrapper));
+    hclib_task_t* task = allocate_lambda_task(std::move(wrapper));
     task->non_blocking = 1;
+    hclib_task_set_producer(task, event);
     spawn(task);
     return event->get_future();
 }
@@ -424,7 +514,7 @@ auto async_future_await(T&& lambda, hclib_future_t *future) ->
         hclib::future_t<decltype(lambda())>* {
     typedef decltype(lambda()) R;
 
-    hclib::promise_t<R> *event = new hclib::promise_t<R>();
+    hclib::promise_t<R> *event = hclib::make_shared_promise<R>(2);
     /*
      * TODO creating this closure may be inefficient. While the capture list is
      * precise, if the user-provided lambda is large then copying it by value
@@ -433,9 +523,7 @@ auto async_future_await(T&& lambda, hclib_future_t *future) ->
     auto wrapper = [event, lambda]() {
         call_and_put_wrapper<T, R>::fn(lambda, event);
     };
-    typedef decltype(wrapper) U;
-
-    hclib_task_t* task = initialize_task(call_lambda<U>, new U(wrapper));
+    hclib_task_t* task = allocate_lambda_task(std::move(wrapper));
     spawn_await(task, future ? &future : NULL, future ? 1 : 0);
     return event->get_future();
 }
@@ -483,7 +571,7 @@ auto async_future_at_helper(T& lambda, hclib_locale_t *locale,
         bool nb) -> hclib::future_t<decltype(lambda())>* {
     typedef decltype(lambda()) R;
 
-    hclib::promise_t<R> *event = new hclib::promise_t<R>();
+    hclib::promise_t<R> *event = hclib::make_shared_promise<R>(2);
     /*
      * TODO creating this closure may be inefficient. While the capture list is
      * precise, if the user-provided lambda is large then copying it by value
@@ -492,10 +580,9 @@ auto async_future_at_helper(T& lambda, hclib_locale_t *locale,
     auto wrapper = [event, lambda]() {
         call_and_put_wrapper<T, R>::fn(lambda, event);
     };
-    typedef decltype(wrapper) U;
-
-    hclib_task_t* task = initialize_task(call_lambda<U>, new U(wrapper));
+    hclib_task_t* task = allocate_lambda_task(std::move(wrapper));
     if (nb) task->non_blocking = 1;
+    hclib_task_set_producer(task, event);
     spawn_await_at(task, NULL, 0, locale);
     return event->get_future();
 }
@@ -517,7 +604,7 @@ auto async_future_await_at(T&& lambda, hclib_future_t *future,
         hclib_locale_t *locale) -> hclib::future_t<decltype(lambda())>* {
     typedef decltype(lambda()) R;
 
-    hclib::promise_t<R> *event = new hclib::promise_t<R>();
+    hclib::promise_t<R> *event = hclib::make_shared_promise<R>(2);
     /*
      * TODO creating this closure may be inefficient. While the capture list is
      * precise, if the user-provided lambda is large then copying it by value
@@ -526,9 +613,7 @@ auto async_future_await_at(T&& lambda, hclib_future_t *future,
     auto wrapper = [event, lambda]() {
         call_and_put_wrapper<T, R>::fn(lambda, event);
     };
-    typedef decltype(wrapper) U;
-
-    hclib_task_t* task = initialize_task(call_lambda<U>, new U(wrapper));
+    hclib_task_t* task = allocate_lambda_task(std::move(wrapper));
     spawn_await_at(task, future ? &future : NULL, future ? 1 : 0,
             locale);
     return event->get_future();
@@ -557,11 +642,37 @@ inline hclib::future_t<void> *nonblocking_finish(
         std::function<void()> &&lambda) {
     hclib_start_finish();
     lambda();
-    hclib::promise_t<void> *event = new hclib::promise_t<void>();
+    hclib::promise_t<void> *event = hclib::make_shared_promise<void>(2);
     hclib_end_finish_nonblocking_helper(event);
     return event->get_future();
 }
 
+/*
+ * Futures satisfied once all of futures are, or once any one of them is with
+ * that future as their value (see hclib_when_all). As with async_future, the
+ * caller owns a reference to the returned future.
+ */
+inline hclib::future_t<void> *when_all(hclib_future_t **futures,
+        const int nfutures) {
+    return (hclib::future_t<void> *)hclib_when_all(futures, nfutures);
+}
+
+inline hclib::future_t<void> *when_all(
+        std::vector<hclib_future_t *> &futures) {
+    return when_all(futures.data(), futures.size());
+}
+
+inline hclib::future_t<hclib_future_t *> *when_any(hclib_future_t **futures,
+        const int nfutures) {
+    return (hclib::future_t<hclib_future_t *> *)hclib_when_any(futures,
+            nfutures);
+}
+
+inline hclib::future_t<hclib_future_t *> *when_any(
+        std::vector<hclib_future_t *> &futures) {
+    return when_any(futures.data(), futures.size());
+}
+
 inline void yield() {
     hclib_yield(NULL);
 }
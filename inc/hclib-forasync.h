@@ -599,11 +599,12 @@ inline hclib::future_t<void> *forasync1D_future(loop_domain_1d* loop, T lambda,
         bool force_seq = false, int mode = FORASYNC_MODE_RECURSIVE,
         hclib_future_t *future = NULL,
         int dist_func_id = HCLIB_DEFAULT_LOOP_DIST) {
-    hclib::promise_t<void> *event = new hclib::promise_t<void>();
+    hclib::promise_t<void> *event = hclib::make_shared_promise<void>(2);
 
     if (force_seq) {
         forasync1D_seq(loop, lambda);
         event->put();
+        hclib::release_future(event->get_future());
         return event->get_future();
     } else {
         hclib_start_finish();
@@ -619,11 +620,12 @@ inline hclib::future_t<void> *forasync1D_nb_future(loop_domain_1d* loop,
         T lambda, bool force_seq = false, int mode = FORASYNC_MODE_RECURSIVE,
         hclib_future_t *future = NULL,
         int dist_func_id = HCLIB_DEFAULT_LOOP_DIST) {
-    hclib::promise_t<void> *event = new hclib::promise_t<void>();
+    hclib::promise_t<void> *event = hclib::make_shared_promise<void>(2);
 
     if (force_seq) {
         forasync1D_seq(loop, lambda);
         event->put();
+        hclib::release_future(event->get_future());
         return event->get_future();
     } else {
         hclib_start_finish();
@@ -639,7 +641,7 @@ inline hclib::future_t<void> *forasync2D_future(loop_domain_2d* loop, T lambda,
         int mode = FORASYNC_MODE_RECURSIVE, hclib_future_t *future = NULL) {
     hclib_start_finish();
     forasync2D_internal<T>(loop->get_internal(), lambda, mode, future);
-    hclib::promise_t<void> *event = new hclib::promise_t<void>();
+    hclib::promise_t<void> *event = hclib::make_shared_promise<void>(2);
     hclib_end_finish_nonblocking_helper(event);
     return event->get_future();
 }
@@ -649,7 +651,7 @@ inline hclib::future_t<void> *forasync3D_future(loop_domain_3d* loop, T lambda,
         int mode = FORASYNC_MODE_RECURSIVE, hclib_future_t *future = NULL) {
     hclib_start_finish();
     forasync3D_internal<T>(loop->get_internal(), lambda, mode, future);
-    hclib::promise_t<void> *event = new hclib::promise_t<void>();
+    hclib::promise_t<void> *event = hclib::make_shared_promise<void>(2);
     hclib_end_finish_nonblocking_helper(event);
     return event->get_future();
 }
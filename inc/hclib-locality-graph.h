@@ -62,8 +62,21 @@ typedef struct _hclib_locale_t {
     void (**idle_funcs)(void);
     unsigned n_idle_funcs;
     int reachable;
+    // Max number of tasks a thief takes from this locale in one steal.
+    int steal_batch;
+    // Number of workers with this locale on their steal path.
+    int n_thieves;
+    // Lowest ID among those workers, or the number of workers if none.
+    int first_thief;
+    // Whether this locale stands for an arena, see hclib_declare_arena.
+    int is_arena;
 
     struct _hclib_deque_t *deques;
+    /*
+     * Tasks handed to this locale by threads that are not HClib workers,
+     * newest first. See locale_inject_task.
+     */
+    struct hclib_task_t *volatile injected;
 } hclib_locale_t;
 
 typedef struct _hclib_locality_graph {
@@ -81,6 +94,8 @@ typedef struct _hclib_worker_paths {
     hclib_locality_path *pop_path;
     hclib_locality_path *steal_path;
     int last_successful_steal_locale;
+    // Locale of the arena this worker belongs to, or NULL.
+    hclib_locale_t *arena;
 } hclib_worker_paths;
 
 extern void load_locality_info(const char *filename, int *nworkers_out,
@@ -89,23 +104,40 @@ extern void load_locality_info(const char *filename, int *nworkers_out,
 extern void generate_locality_info(int *nworkers_out,
         hclib_locality_graph **graph_out,
         hclib_worker_paths **worker_paths_out);
+extern void free_locality_info(hclib_locality_graph *graph,
+        hclib_worker_paths *worker_paths, int nworkers);
 extern void check_locality_graph(hclib_locality_graph *graph,
         hclib_worker_paths *worker_paths, int nworkers);
 extern void print_locality_graph(hclib_locality_graph *graph);
 extern void print_worker_paths(hclib_worker_paths *worker_paths, int nworkers);
+extern void build_victim_orders(hclib_worker_state **workers, int nworkers,
+        hclib_locality_graph *graph);
+extern void free_victim_orders(hclib_worker_state **workers, int nworkers);
+extern void mark_private_deques(hclib_worker_paths *worker_paths, int nworkers);
 extern int deque_push_locale(hclib_worker_state *ws, hclib_locale_t *locale,
         void *ele);
+extern void deque_push_batch_locale(hclib_worker_state *ws,
+        hclib_locale_t *locale, void **eles, int n);
 extern size_t workers_backlog(hclib_worker_state *ws);
+extern int path_contains(hclib_locality_path *path, hclib_locale_t *locale);
 extern struct hclib_task_t *locale_pop_task(hclib_worker_state *ws);
 extern int locale_steal_task(hclib_worker_state *ws, void **stolen,
         int *out_victim);
 extern unsigned locale_num_tasks(hclib_locale_t *locale);
+extern void locale_inject_task(hclib_locale_t *locale,
+        struct hclib_task_t *task);
+extern struct hclib_task_t *locale_drain_injected(hclib_worker_state *ws);
+extern void locale_hand_off_tasks(hclib_worker_state *ws);
+extern struct hclib_task_t *locale_find_retired_task(hclib_worker_state *ws);
 
 extern void locale_run_idle_tasks(hclib_worker_state *ws);
 extern void locale_register_idle_task(hclib_locale_t *locale, void (*fp)(void));
 
 extern void hclib_locale_mark_special(hclib_locale_t *locale,
         const char *special_type);
+extern void hclib_locale_set_steal_batch(hclib_locale_t *locale,
+        int steal_batch);
+extern int hclib_locale_get_steal_batch(hclib_locale_t *locale);
 
 extern int hclib_get_num_locales();
 extern hclib_locale_t *hclib_get_closest_locale();
@@ -122,6 +154,23 @@ extern int hclib_get_num_locales_of_type(int locale_type);
 
 extern unsigned hclib_add_known_locale_type(const char *lbl);
 
+/*
+ * Arenas are named subsets of workers set aside for some of the tasks of a
+ * program, e.g. to keep a few cores free for latency-sensitive requests while
+ * bulk work runs on the others. Each arena is a locale whose only thieves are
+ * its workers, and which is their only pop and steal path, so they never run
+ * anything else. Tasks spawned by a task running in an arena, or submitted to
+ * it with hclib_arena_submit, stay in that arena.
+ *
+ * Arenas are declared before the runtime starts, either with
+ * hclib_declare_arena or in the "arenas" object of the locality file, which
+ * maps arena names to arrays of worker IDs. Worker 0 runs the root task and
+ * can not be part of an arena.
+ */
+extern void hclib_declare_arena(const char *name, const int *worker_ids,
+        int nworkers);
+extern hclib_locale_t *hclib_get_arena(const char *name);
+
 #ifdef __cplusplus
 }
 #endif
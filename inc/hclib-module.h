@@ -104,6 +104,7 @@ unsigned hclib_add_per_worker_module_state(size_t state_size,
 void *hclib_get_curr_worker_module_state(const unsigned state_id);
 void hclib_release_per_worker_module_state(const unsigned state_id,
         hclib_state_releaser cb, void *user_data);
+void hclib_free_per_worker_module_state();
 #ifdef __cplusplus
 }
 #endif
@@ -76,6 +76,11 @@ struct hclib_task_t;
 typedef struct hclib_promise_st {
     hclib_future_t future;
     volatile int satisfied;
+    /*
+     * Number of references held on a shared promise, see
+     * hclib_promise_create_shared, or 0 if it is not reference counted.
+     */
+    volatile int nrefs;
     void *volatile datum;
     /*
      * List of tasks that are awaiting the satisfaction of this promise.
@@ -87,6 +92,11 @@ typedef struct hclib_promise_st {
      * anymore.
      */
     struct hclib_task_t *volatile wait_list_head;
+    /*
+     * Task that will satisfy this promise, if known and not started yet. See
+     * hclib_task_set_producer.
+     */
+    struct hclib_task_t *volatile producer;
 } hclib_promise_t;
 
 /**
@@ -100,6 +110,38 @@ hclib_promise_t *hclib_promise_create();
  */
 void hclib_promise_init(hclib_promise_t *promise);
 
+/*
+ * Shared promises are reference counted, and their memory is taken from and
+ * given back to the runtime's per-worker pools, so they are cheap to create
+ * and are released on their own. Whoever will put on the promise holds one
+ * reference, and each consumer holding on to its future another, including
+ * any task waiting on it. The last one to drop its reference releases the
+ * promise.
+ *
+ * hclib_async_future, hclib_submit, hclib_end_finish_nonblocking and the
+ * service and arena submission functions return the future of such a promise,
+ * with one reference for the caller. Promises must not be released after the
+ * runtime has shut down.
+ */
+hclib_promise_t *hclib_promise_create_shared(int nrefs);
+
+/*
+ * Initialize a shared promise at the start of memory returned by
+ * hclib_object_alloc, which is given back with hclib_object_free on release.
+ */
+void hclib_promise_init_shared(hclib_promise_t *promise, int nrefs);
+
+/*
+ * Take one more reference on the shared promise behind future.
+ */
+void hclib_future_retain(hclib_future_t *future);
+
+/*
+ * Drop a reference on the shared promise behind future, releasing it if that
+ * was the last.
+ */
+void hclib_future_release(hclib_future_t *future);
+
 /**
  * Fetch the future associated with the provided promise. Tasks can then express
  * their dependencies on the satisfaction of the promise by awaiting on this
@@ -155,4 +197,19 @@ void *hclib_future_wait(hclib_future_t *future);
  */
 int hclib_future_is_satisfied(hclib_future_t *future);
 
+/*
+ * Combine futures into one that is satisfied once all of them are (with a
+ * NULL datum), or once any one of them is (with that future as its datum).
+ * The puts on these futures satisfy the result directly, without running any
+ * task. The result is shared (see hclib_promise_create_shared) and the caller
+ * owns a reference to it.
+ *
+ * If the futures that are already satisfied decide the result, only the
+ * resulting promise is allocated. Otherwise the promise and one wait list node
+ * per future are allocated together, from the worker's slab for up to 11
+ * futures and from the system allocator beyond that.
+ */
+hclib_future_t *hclib_when_all(hclib_future_t **futures, int nfutures);
+hclib_future_t *hclib_when_any(hclib_future_t **futures, int nfutures);
+
 #endif /* HCLIB_PROMISE_H_ */
@@ -50,7 +50,6 @@ extern "C" {
 #endif
 
 // forward declaration
-extern pthread_key_t ws_key;
 struct hc_context;
 struct hclib_options;
 struct place_t;
@@ -90,6 +89,12 @@ typedef struct _hclib_worker_state {
     LiteCtx *curr_ctx;
     // Root context of the whole runtime instance.
     LiteCtx *root_ctx;
+    // Idle contexts kept around by this worker for reuse, and their number.
+    LiteCtx *ctx_pool;
+    int ctx_pool_size;
+    // Same for finish scopes.
+    struct finish_t *finish_pool;
+    int finish_pool_size;
     // The id, identify a worker.
     int id;
     // Total number of workers in this instance of the HClib runtime.
@@ -103,11 +108,83 @@ typedef struct _hclib_worker_state {
      */
     int base_intra_socket_workers;
     int limit_intra_socket_workers;
+    /*
+     * Order in which this worker visits victims when stealing, nearest first.
+     * steal_victims is split into n_victim_tiers groups of workers at the same
+     * distance, group i ending at victim_tier_ends[i]. Victims within a group
+     * are visited starting from a random one.
+     */
+    int *steal_victims;
+    int *victim_tier_ends;
+    int n_victim_tiers;
+    /*
+     * Upper bound on the number of tasks in the higher priority lanes of this
+     * worker's deques, and how many tasks in a row it took from them.
+     */
+    unsigned prio_tasks;
+    unsigned prio_streak;
+    // Last victim this worker stole from, tried first on the next steal.
+    int last_victim;
+    // State of this worker's random number generator for victim selection.
+    unsigned steal_rand;
 
     /*
      * Information on currently executing task.
      */
     void *curr_task;
+    /*
+     * Only used in heartbeat mode (HCLIB_HEARTBEAT_US). Tasks spawned by this
+     * worker that thieves cannot see yet, from latent_head (oldest) to
+     * latent_tail, in a ring of HCLIB_LATENT_TASKS slots. They are run by this
+     * worker ahead of its deques, unless promoted to its deque first.
+     */
+    struct hclib_task_t **latent_tasks;
+    unsigned latent_head;
+    unsigned latent_tail;
+    // Spawns and pops since the last look at the clock, and the next heartbeat
+    unsigned latent_polls;
+    unsigned long long next_heartbeat;
+    /*
+     * Finish scope on which this worker defers the check-ins of the tasks it
+     * spawns, and how many of those it spawned and completed itself.
+     */
+    struct finish_t *deferred_finish;
+    unsigned deferred_spawned;
+    unsigned deferred_completed;
+    /*
+     * How many of those were checked in on deferred_finish by other workers
+     * after stealing them, or by this worker when suspending them. Written by
+     * thieves, so it is kept on its own cache line.
+     */
+    volatile int deferred_transferred __attribute__ ((aligned (64)));
+    /*
+     * Only used in private deque mode (HCLIB_PRIVATE_DEQUES), where thieves
+     * ask this worker for tasks instead of taking them from its deques. Holds
+     * the ID + 1 of the thief waiting for an answer, 0 if there is none, or -1
+     * while this worker is answering. Also written by thieves.
+     */
+    volatile int steal_request;
+    /*
+     * Set by thieves that would like this worker to promote some of its latent
+     * tasks, in heartbeat mode.
+     */
+    volatile int latent_wanted;
+
+    /*
+     * Filled in by this worker before asking a victim for tasks: the locale to
+     * take them from and where to store them. The victim then writes the
+     * number of tasks it handed over to steal_response.
+     */
+    struct _hclib_locale_t *steal_locale;
+    void **steal_buffer;
+    volatile int steal_response __attribute__ ((aligned (64)));
+    /*
+     * Set while this worker is retired (see hclib_set_num_active_workers), and
+     * so has no tasks for thieves to look for.
+     */
+    volatile int retired;
+    // Tasks looked for since the elastic controller last checked our backlog
+    unsigned elastic_polls;
 } __attribute__ ((aligned (128))) hclib_worker_state;
 
 #define HCLIB_MACRO_CONCAT(x, y) _HCLIB_MACRO_CONCAT_IMPL(x, y)
@@ -116,7 +193,7 @@ typedef struct _hclib_worker_state {
 #ifdef HC_ASSERTION_CHECK
 #define HASSERT(cond) { \
     if (!(cond)) { \
-        if (pthread_getspecific(ws_key)) { \
+        if (CURRENT_WS_INTERNAL) { \
             fprintf(stderr, "W%d: assertion failure\n", hclib_get_current_worker()); \
         } \
         assert(cond); \
@@ -137,17 +214,58 @@ typedef int HCLIB_MACRO_CONCAT(_hc_static_assert, __COUNTER__)[(COND) ? 1 : -1]
 #warning "Static assertions are not available"
 #endif
 
-#define CURRENT_WS_INTERNAL ((hclib_worker_state *) pthread_getspecific(ws_key))
+/*
+ * Worker state of the calling thread, or NULL if it is not an HClib worker.
+ * Read it through CURRENT_WS_INTERNAL rather than directly.
+ */
+extern __thread hclib_worker_state *_hclib_curr_ws
+    __attribute__((tls_model("initial-exec")));
 
 int hclib_get_current_worker();
 hclib_worker_state* current_ws();
 
+#if defined(__x86_64__) && defined(__linux__)
+/*
+ * A task may be suspended on one worker thread and resumed on another. The
+ * compiler assumes the thread pointer never changes within a function, and
+ * would happily reuse the address of _hclib_curr_ws it computed before a call
+ * that switched contexts. Computing the address in a volatile asm forces it to
+ * be recomputed at every use, while still being a couple of instructions.
+ */
+static inline hclib_worker_state *_hclib_current_ws() {
+    hclib_worker_state **slot;
+    __asm__ __volatile__ ("movq %%fs:0, %0\n\t"
+                          "addq _hclib_curr_ws@gottpoff(%%rip), %0"
+                          : "=r" (slot));
+    return *slot;
+}
+#define CURRENT_WS_INTERNAL (_hclib_current_ws())
+#else
+// Out of line, so the thread pointer is looked up again on every call
+#define CURRENT_WS_INTERNAL (current_ws())
+#endif
+
 typedef void (*generic_frame_ptr)(void*);
 
 #include "hclib-timer.h"
 #include "hclib-promise.h"
 
 int  hclib_get_num_workers();
+/*
+ * Number of workers currently taking part in running tasks. The others are
+ * retired: they do not run or steal tasks, and sleep until reactivated. Setting
+ * it to n (between 1 and hclib_get_num_workers()) retires workers n and up, and
+ * reactivates those below. Retiring workers hand their queued tasks to the
+ * others first, so nothing is lost, though a worker only retires once it is
+ * done with the task it is running. Tasks spawned later at a locale that only
+ * retired workers take tasks from wait for one of them to be reactivated.
+ *
+ * With HCLIB_ELASTIC_IDLE_US set, the runtime also retires workers that stay
+ * idle for that long, and reactivates them when tasks pile up, up to the last
+ * value set here. May be called from any thread.
+ */
+int  hclib_get_num_active_workers();
+void hclib_set_num_active_workers(int n);
 void hclib_start_finish();
 void hclib_end_finish();
 void hclib_user_harness_timer(double dur);
@@ -11,6 +11,17 @@
  */
 #define MAX_HCLIB_ASYNC_ARG_SIZE (sizeof(void *) + sizeof(void *))
 
+/*
+ * Tasks may be given a priority from HCLIB_PRIORITY_DEFAULT (0) up to
+ * HCLIB_PRIORITY_MAX. Each deque has one lane per priority, and workers look for
+ * work in the higher lanes first.
+ */
+#ifndef HCLIB_NUM_PRIORITIES
+#define HCLIB_NUM_PRIORITIES 3
+#endif
+#define HCLIB_PRIORITY_DEFAULT 0
+#define HCLIB_PRIORITY_MAX (HCLIB_NUM_PRIORITIES - 1)
+
 /*
  * The core task representation, including:
  *
@@ -28,6 +39,19 @@
  *   6) non_blocking: Whether this task will block on other operations (i.e.
  *      call hclib_end_finish, hclib_future_wait, etc).
  *   7) next_waiter: Used to track tasks blocked on the same future.
+ *   8) deferred_checkin: 1 + the ID of the worker that spawned this task, if
+ *      that worker deferred checking the task in on current_finish, else 0.
+ *   9) priority: Which lane of a deque this task goes to, see
+ *      HCLIB_NUM_PRIORITIES.
+ *  10) work_first_depth: In work-first mode, how many of this task's
+ *      ancestors were suspended to run their child first.
+ *  11) produces: The promise this task will satisfy, if it was linked to it
+ *      with hclib_task_set_producer.
+ *  12) producer_claim: For such tasks, 1 + the ID of the worker that runs it,
+ *      either from a deque or inline while waiting on that promise. 0 until
+ *      one of them claims it.
+ *  13) inline_parent: The task that was running on the same stack when this
+ *      one was started, if any, and that resumes once it completes.
  */
 typedef struct hclib_task_t {
     generic_frame_ptr _fp;
@@ -40,6 +64,12 @@ typedef struct hclib_task_t {
     int waiting_on_index;
     hclib_locale_t *locale;
     int non_blocking;
+    int deferred_checkin;
+    int priority;
+    int work_first_depth;
+    volatile int producer_claim;
+    hclib_promise_t *produces;
+    struct hclib_task_t *inline_parent;
     struct hclib_task_t *next_waiter;
 } hclib_task_t;
 
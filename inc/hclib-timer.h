@@ -32,8 +32,18 @@ void hclib_init_stats(int start_worker, int end_worker);
 void hclib_set_state(int wid, int state);
 void hclib_get_avg_time (double* t_work, double *t_ovh, double* t_search);
 
+#ifdef _TIMER_ON_
 #define MARK_BUSY(w)	hclib_set_state(w, HCLIB_WORK);
 #define MARK_OVH(w)		hclib_set_state(w, HCLIB_OVH);
 #define MARK_SEARCH(w)	hclib_set_state(w, HCLIB_SEARCH);
+#else
+/*
+ * The worker ID argument is not evaluated either, so these cost nothing on the
+ * spawn path when timing is disabled.
+ */
+#define MARK_BUSY(w)
+#define MARK_OVH(w)
+#define MARK_SEARCH(w)
+#endif
 
 #endif /* HCLIB_TIMER_H_ */
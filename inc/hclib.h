@@ -72,6 +72,33 @@ void hclib_finalize(const int instrument);
 void hclib_launch(async_fct_t fct_ptr, void * arg, const char **deps,
         int ndeps);
 
+/**
+ * Service mode, for programs that run many parallel computations over time
+ * rather than a single one under hclib_launch. hclib_service_start brings up the
+ * runtime and returns, leaving its workers asleep until there is work for them.
+ * Each root task submitted with hclib_service_submit or hclib_service_run then
+ * runs in its own finish scope, and the returned future is satisfied once it
+ * and everything it spawned completed. The caller owns a reference to that
+ * future, to drop with hclib_future_release. These may be called from any
+ * thread.
+ *
+ * hclib_service_stop waits for all submitted root tasks and shuts the runtime
+ * down. It must not race with submissions. The runtime can then be started
+ * again, as long as all modules it depends on support being reinitialized.
+ */
+void hclib_service_start(const char **deps, int ndeps);
+hclib_future_t *hclib_service_submit(async_fct_t fct_ptr, void *arg);
+void hclib_service_run(async_fct_t fct_ptr, void *arg);
+void hclib_service_stop();
+
+/**
+ * Run a root task in an arena (see hclib_declare_arena), from any thread while
+ * the runtime is running. As in service mode it runs in its own finish scope,
+ * whose end satisfies the returned future, rather than in that of the caller.
+ */
+hclib_future_t *hclib_arena_submit(hclib_locale_t *arena, async_fct_t fct_ptr,
+        void *arg);
+
 /**
  * Time keeping utilities.
  */
@@ -112,6 +139,15 @@ void hclib_async(generic_frame_ptr fp, void *arg,
         hclib_future_t **futures, const int nfutures,
         hclib_locale_t *locale);
 
+/**
+ * A variant of hclib_async for tasks that should run ahead of others, such as
+ * communication continuations or tasks on the critical path. priority ranges
+ * from HCLIB_PRIORITY_DEFAULT (what hclib_async uses) to HCLIB_PRIORITY_MAX.
+ */
+void hclib_async_with_priority(generic_frame_ptr fp, void *arg,
+        hclib_future_t **futures, const int nfutures,
+        hclib_locale_t *locale, const int priority);
+
 /**
  * A variant of hclib_async that promises the created task will not block (i.e.
  * will not wait on a future, close a finish scope, etc.)
@@ -119,7 +155,20 @@ void hclib_async(generic_frame_ptr fp, void *arg,
 void hclib_async_nb(generic_frame_ptr fp, void *arg, hclib_locale_t *locale);
 
 /*
- * Spawn an async that automatically puts a promise on termination.
+ * Hand fp(arg) to the runtime from a thread that is not one of its workers,
+ * e.g. a network thread or a callback from a third party library. It runs at
+ * locale (or the central locale if NULL) outside of any finish scope. The
+ * returned future is satisfied with its result and can be waited on from the
+ * same thread, and the caller drops its reference to it with
+ * hclib_future_release. May be called from any thread while the runtime is
+ * running.
+ */
+hclib_future_t *hclib_submit(future_fct_t fp, void *arg,
+        hclib_locale_t *locale);
+
+/*
+ * Spawn an async that automatically puts a promise on termination. The promise
+ * is released once the caller called hclib_future_release on its future.
  */
 hclib_future_t *hclib_async_future(future_fct_t fp, void *arg,
         hclib_future_t **futures, const int nfutures, hclib_locale_t *locale);
@@ -225,7 +274,8 @@ void hclib_end_finish();
 
 /*
  * Get a promise that is triggered when all tasks inside this finish scope have
- * finished, but return immediately.
+ * finished, but return immediately. It is shared, see
+ * hclib_promise_create_shared.
  */
 hclib_future_t *hclib_end_finish_nonblocking();
 void hclib_end_finish_nonblocking_helper(hclib_promise_t *event);
@@ -261,6 +311,14 @@ void hclib_print_runtime_stats(FILE *fp);
 
 void hclib_default_queue_capacity(int* used, int* capacity);
 
+/*
+ * Returns the number of bytes currently held by the work-stealing deques of all
+ * locales, including the task buffers of deques that have been pushed to. The
+ * number of deques that have been materialized so far is returned in
+ * materialized_out if it is non-NULL.
+ */
+size_t hclib_get_deque_footprint(int *materialized_out);
+
 /**
  * @}
  */
@@ -28,16 +28,14 @@ inline void finalize(const int instrument) {
 
 template <typename T>
 inline void launch(const char **deps, int ndeps, T &&lambda) {
-    typedef typename std::remove_reference<T>::type U;
-    hclib_task_t *user_task = _allocate_async(new U(lambda));
+    hclib_task_t *user_task = _allocate_async(&lambda);
     hclib_launch((generic_frame_ptr)spawn, user_task, deps, ndeps);
 }
 
 template <typename T>
 inline void launch(const int nworkers, const char **deps, int ndeps,
         T &&lambda) {
-    typedef typename std::remove_reference<T>::type U;
-    hclib_task_t *user_task = _allocate_async(new U(lambda));
+    hclib_task_t *user_task = _allocate_async(&lambda);
 
     char nworkers_str[32];
     sprintf(nworkers_str, "%d", nworkers);
@@ -46,9 +44,57 @@ inline void launch(const int nworkers, const char **deps, int ndeps,
     hclib_launch((generic_frame_ptr)spawn, user_task, deps, ndeps);
 }
 
-extern hclib_worker_state *current_ws();
+/*
+ * Service mode, see hclib_service_start.
+ */
+inline void service_start(const char **deps, int ndeps) {
+    hclib_service_start(deps, ndeps);
+}
+
+template <typename T>
+inline hclib::future_t<void> *service_submit(T &&lambda) {
+    hclib_task_t *user_task = _allocate_async(&lambda);
+    return (hclib::future_t<void> *)hclib_service_submit(
+            (generic_frame_ptr)spawn, user_task);
+}
+
+template <typename T>
+inline void service_run(T &&lambda) {
+    hclib::future_ref_t<void> done = service_submit(std::forward<T>(lambda));
+    done->wait();
+}
+
+inline void service_stop() {
+    hclib_service_stop();
+}
+
+/*
+ * Arenas, see hclib_declare_arena.
+ */
+inline void declare_arena(const char *name, const int *worker_ids,
+        int nworkers) {
+    hclib_declare_arena(name, worker_ids, nworkers);
+}
+
+inline hclib::locale_t *get_arena(const char *name) {
+    return hclib_get_arena(name);
+}
+
+template <typename T>
+inline hclib::future_t<void> *arena_submit(hclib::locale_t *arena,
+        T &&lambda) {
+    hclib_task_t *user_task = _allocate_async(&lambda);
+    return (hclib::future_t<void> *)hclib_arena_submit(arena,
+            (generic_frame_ptr)spawn, user_task);
+}
+
+inline hclib_worker_state *current_ws() {
+    return CURRENT_WS_INTERNAL;
+}
 int get_current_worker();
 int get_num_workers();
+int get_num_active_workers();
+void set_num_active_workers(int n);
 
 int get_num_locales();
 hclib_locale_t *get_closest_locale();
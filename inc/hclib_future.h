@@ -1,33 +1,59 @@
 #ifndef HCLIB_FUTURE_H
 #define HCLIB_FUTURE_H
 
+#include <type_traits>
+#include <utility>
+
 #include "hclib-promise.h"
 
 namespace hclib {
 
-// Specialized for scalar types
+/*
+ * Whether values of type T are put in the void* datum of a promise. Larger
+ * values, and values that can't be recast to void*, are stored inline in their
+ * promise_t<T> and the datum points to them.
+ */
 template<typename T>
-struct future_t: public hclib_future_t {
-
-    HASSERT_STATIC(sizeof(T) <= sizeof(void*),
-            "future_t arg type is too large to store by value.");
+struct fits_in_datum : std::integral_constant<bool, sizeof(T) <= sizeof(void*) &&
 #if HAVE_CXX11_TRIVIAL_COPY_CHECK
-    HASSERT_STATIC(std::is_trivially_copyable<T>::value,
-            "future_t arg type can't be recast to void*.");
+        std::is_trivially_copyable<T>::value
+#else
+        std::is_trivial<T>::value
 #endif  // HAVE_CXX11_TRIVIAL_COPY_CHECK
+        > { };
 
+template<typename T, bool in_datum = fits_in_datum<T>::value>
+struct future_value {
     union _ValUnion { T val; void *vp; };
 
-    T get() {
+    static T unpack(void *datum) {
         _ValUnion tmp;
-        tmp.vp = hclib_future_get(this);
+        tmp.vp = datum;
         return tmp.val;
     }
+};
+
+/*
+ * Values stored inline in the promise are moved out of it, so only one of the
+ * consumers of such a future should get its value.
+ */
+template<typename T>
+struct future_value<T, false> {
+    static T unpack(void *datum) {
+        return std::move(*static_cast<T*>(datum));
+    }
+};
+
+// Specialized for value types
+template<typename T>
+struct future_t: public hclib_future_t {
+
+    T get() {
+        return future_value<T>::unpack(hclib_future_get(this));
+    }
 
     T wait() {
-        _ValUnion tmp;
-        tmp.vp = hclib_future_wait(this);
-        return tmp.val;
+        return future_value<T>::unpack(hclib_future_wait(this));
     }
 
     bool test() { return hclib_future_is_satisfied(this); }
@@ -31,30 +31,63 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef HCLIB_PROMISE_H
 #define HCLIB_PROMISE_H
 
+#include <new>
+#include <utility>
+
 #include "hclib-promise.h"
+#include "hclib-async-struct.h"
 #include "hclib_future.h"
 
 namespace hclib {
 
-// Specialized for pointers
-// (and pointer-sized value types)
-template<typename T>
-struct promise_t: public hclib_promise_t {
-
-    HASSERT_STATIC(sizeof(T) <= sizeof(void*),
-            "promise_t arg type is too large to store by value.");
-#if HAVE_CXX11_TRIVIAL_COPY_CHECK
-    HASSERT_STATIC(std::is_trivially_copyable<T>::value,
-            "promise_t arg type can't be recast to void*.");
-#endif  // HAVE_CXX11_TRIVIAL_COPY_CHECK
-
-    promise_t() { hclib_promise_init(this); }
+/*
+ * How promise_t<T> stores the values put on it, see fits_in_datum. Small
+ * values go in the datum itself.
+ */
+template<typename T, bool in_datum = fits_in_datum<T>::value>
+struct promise_value_t: public hclib_promise_t {
 
     void put(T datum) {
         void *tmp;
         *reinterpret_cast<T*>(&tmp) = datum;
         hclib_promise_put(this, tmp);
     }
+};
+
+/*
+ * Other values are constructed in storage that is part of the promise, and
+ * destroyed with it.
+ */
+template<typename T>
+struct promise_value_t<T, false>: public hclib_promise_t {
+
+    promise_value_t() { }
+    promise_value_t(const promise_value_t &) = delete;
+    promise_value_t &operator=(const promise_value_t &) = delete;
+
+    ~promise_value_t() {
+        if (satisfied) {
+            reinterpret_cast<T*>(&value)->~T();
+        }
+    }
+
+    void put(const T &datum) {
+        hclib_promise_put(this, new (&value) T(datum));
+    }
+
+    void put(T &&datum) {
+        hclib_promise_put(this, new (&value) T(std::move(datum)));
+    }
+
+private:
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type value;
+};
+
+// Specialized for value types
+template<typename T>
+struct promise_t: public promise_value_t<T> {
+
+    promise_t() { hclib_promise_init(this); }
 
     future_t<T> *get_future() {
         // this is the simplest expression I could come up with
@@ -119,9 +152,76 @@ struct promise_t<void>: public hclib_promise_t {
     future_t<void> &future() { return *get_future(); }
 };
 
+/*
+ * Shared promises, see hclib_promise_create_shared. A promise_t<T> created by
+ * make_shared_promise destroys any value stored inline in it when it is
+ * released, which is why these are dropped with release_future rather than
+ * hclib_future_release.
+ */
+template<typename T>
+promise_t<T> *make_shared_promise(int nrefs) {
+    promise_t<T> *promise = new (hclib_object_alloc(sizeof(promise_t<T>)))
+        promise_t<T>();
+    promise->nrefs = nrefs;
+    return promise;
+}
+
+template<typename T>
+void retain_future(future_t<T> *future) {
+    hclib_future_retain(future);
+}
+
+template<typename T>
+void release_future(future_t<T> *future) {
+    promise_t<T> *promise = static_cast<promise_t<T>*>(future->owner);
+    HASSERT(promise->nrefs > 0 && "not a shared promise");
+    if (__sync_sub_and_fetch(&promise->nrefs, 1) == 0) {
+        promise->~promise_t<T>();
+        hclib_object_free(promise);
+    }
+}
+
+/*
+ * Holds a reference to a shared future, such as the ones returned by
+ * async_future and its variants, and drops it when it goes out of scope.
+ * Initializing one from a raw future takes over the reference owned by the
+ * caller. Tasks waiting on the future should capture a future_ref_t, so that
+ * the promise outlives them.
+ */
+template<typename T>
+class future_ref_t {
+    future_t<T> *fut;
+
+public:
+    future_ref_t() : fut(nullptr) { }
+    future_ref_t(future_t<T> *future) : fut(future) { }
+
+    future_ref_t(const future_ref_t &other) : fut(other.fut) {
+        if (fut) retain_future(fut);
+    }
+
+    future_ref_t(future_ref_t &&other) : fut(other.fut) {
+        other.fut = nullptr;
+    }
+
+    future_ref_t &operator=(future_ref_t other) {
+        std::swap(fut, other.fut);
+        return *this;
+    }
+
+    ~future_ref_t() {
+        if (fut) release_future(fut);
+    }
+
+    future_t<T> *get_future() const { return fut; }
+    future_t<T> *operator->() const { return fut; }
+};
+
 // assert that we can safely cast back and forth between the C and C++ types
 HASSERT_STATIC(sizeof(promise_t<void*>) == sizeof(hclib_promise_t),
         "promise_t is a trivial wrapper around hclib_promise_t");
+HASSERT_STATIC(sizeof(promise_t<int>) == sizeof(hclib_promise_t),
+        "promise_t of a value that fits in the datum has no extra storage");
 
 }
 
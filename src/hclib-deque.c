@@ -39,68 +39,172 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "hclib-internal.h"
 #include "hclib-atomics.h"
 
+static hclib_deque_buffer_t *deque_buffer_create(long capacity) {
+    hclib_deque_buffer_t *buf = (hclib_deque_buffer_t *)malloc(
+            sizeof(*buf) + capacity * sizeof(buf->data[0]));
+    assert(buf);
+    buf->capacity = capacity;
+    buf->prev = NULL;
+    return buf;
+}
+
+static inline hclib_task_t *deque_buffer_get(hclib_deque_buffer_t *buf,
+        long i) {
+    return atomic_load_explicit(&buf->data[i & (buf->capacity - 1)],
+            memory_order_relaxed);
+}
+
+static inline void deque_buffer_put(hclib_deque_buffer_t *buf, long i,
+        hclib_task_t *t) {
+    atomic_store_explicit(&buf->data[i & (buf->capacity - 1)], t,
+            memory_order_relaxed);
+}
+
+/*
+ * Called by the owner when its buffer is full. Thieves may concurrently be
+ * reading entries in [head, tail) from the old buffer, which stays valid
+ * because it is only retired, not freed.
+ */
+static hclib_deque_buffer_t *deque_grow(hclib_internal_deque_t *deq,
+        hclib_deque_buffer_t *old, long head, long tail) {
+    hclib_deque_buffer_t *buf = deque_buffer_create(2 * old->capacity);
+    long i;
+    for (i = head; i < tail; i++) {
+        deque_buffer_put(buf, i, deque_buffer_get(old, i));
+    }
+    buf->prev = old;
+    atomic_store_explicit(&deq->buffer, buf, memory_order_release);
+    return buf;
+}
+
+/*
+ * Deques start out without a buffer, which is only allocated on the first push
+ * to them. Most locales are only ever pushed to by a few workers (if any), so
+ * this keeps the runtime footprint proportional to the deques actually in use
+ * rather than to nlocales * nworkers.
+ */
 void deque_init(hclib_internal_deque_t *deq, void *init_value) {
-    deq->head = 0;
-    deq->tail = 0;
+    atomic_init(&deq->head, 0);
+    atomic_init(&deq->tail, 0);
+    atomic_init(&deq->buffer, NULL);
 }
 
 /*
- * push an entry onto the tail of the deque
+ * Make sure there is room for n more entries in the deque, currently holding
+ * [head, tail), allocating or growing its buffer if needed. Only called by the
+ * owner.
  */
-int deque_push(hclib_internal_deque_t *deq, void *entry) {
-    int size = deq->tail - deq->head;
-    if (size == INIT_DEQUE_CAPACITY) { /* deque looks full */
-        /* may not grow the deque if some interleaving steal occur */
-        return 0;
+static hclib_deque_buffer_t *deque_reserve(hclib_internal_deque_t *deq,
+        long head, long tail, int n) {
+    hclib_deque_buffer_t *buf = atomic_load_explicit(&deq->buffer,
+            memory_order_relaxed);
+
+    if (buf == NULL) { /* first push to this deque */
+        long capacity = INIT_DEQUE_CAPACITY;
+        while (capacity < n) capacity *= 2;
+        buf = deque_buffer_create(capacity);
+        atomic_store_explicit(&deq->buffer, buf, memory_order_release);
     }
-    const int n = (deq->tail) % INIT_DEQUE_CAPACITY;
-    deq->data[n] = (hclib_task_t *) entry;
+    while (tail - head + n > buf->capacity) { /* deque is full */
+        buf = deque_grow(deq, buf, head, tail);
+    }
+    return buf;
+}
 
-    // Required to guarantee ordering of setting data[n] with incrementing tail.
-    hc_mfence();
+/*
+ * push an entry onto the tail of the deque, growing it if necessary. Always
+ * succeeds.
+ */
+int deque_push(hclib_internal_deque_t *deq, void *entry) {
+    const long tail = atomic_load_explicit(&deq->tail, memory_order_relaxed);
+    const long head = atomic_load_explicit(&deq->head, memory_order_acquire);
+    hclib_deque_buffer_t *buf = deque_reserve(deq, head, tail, 1);
+    deque_buffer_put(buf, tail, (hclib_task_t *)entry);
 
-    deq->tail++;
+    // Orders the write of the slot before the publication of the new tail.
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&deq->tail, tail + 1, memory_order_relaxed);
     return 1;
 }
 
-void deque_destroy(hclib_internal_deque_t *deq) {
-    free(deq);
+/*
+ * push n entries onto the tail of the deque, in order, publishing them to
+ * thieves all at once.
+ */
+void deque_push_batch(hclib_internal_deque_t *deq, void **entries, int n) {
+    const long tail = atomic_load_explicit(&deq->tail, memory_order_relaxed);
+    const long head = atomic_load_explicit(&deq->head, memory_order_acquire);
+    int i;
+
+    if (n <= 0) return;
+
+    hclib_deque_buffer_t *buf = deque_reserve(deq, head, tail, n);
+    for (i = 0; i < n; i++) {
+        deque_buffer_put(buf, tail + i, (hclib_task_t *)entries[i]);
+    }
+
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&deq->tail, tail + n, memory_order_relaxed);
 }
 
 /*
- * The steal protocol. Returns the number of tasks stolen, up to
- * STEAL_CHUNK_SIZE. stolen must have enough space to store up to
- * STEAL_CHUNK_SIZE task pointers.
+ * Release the buffers backing this deque. The deque itself is embedded in a
+ * hclib_deque_t and is owned by the locale.
  */
-int deque_steal(hclib_internal_deque_t *deq, void **stolen) {
-    /* Cannot read deq->data[head] here
-     * Can happen that head=tail=0, then the owner of the deq pushes
-     * a new task when stealer is here in the code, resulting in head=0, tail=1
-     * All other checks down-below will be valid, but the old value of the buffer head
-     * would be returned by the steal rather than the new pushed value.
-     */
+void deque_destroy(hclib_internal_deque_t *deq) {
+    hclib_deque_buffer_t *buf = atomic_load_explicit(&deq->buffer,
+            memory_order_relaxed);
+    while (buf) {
+        hclib_deque_buffer_t *prev = buf->prev;
+        free(buf);
+        buf = prev;
+    }
+    atomic_store_explicit(&deq->buffer, NULL, memory_order_relaxed);
+}
 
+/*
+ * The steal protocol. Returns the number of tasks stolen, up to max_steal and
+ * up to half of the tasks found in the deque (rounded up). stolen must have
+ * enough space to store up to max_steal task pointers, and is filled oldest
+ * task first.
+ *
+ * Each task is claimed with its own CAS on head. Claiming several at once
+ * would race with deque_pop, which only synchronizes with thieves when a
+ * single task is left.
+ */
+int deque_steal(hclib_internal_deque_t *deq, void **stolen, int max_steal) {
     int nstolen = 0;
 
     int success;
     do {
-        const int head = deq->head;
-        hc_mfence();
-        const int tail = deq->tail;
-
-        if ((tail - head) <= 0) {
-            success = 0;
-        } else {
-            hclib_task_t *t = (hclib_task_t *) deq->data[head % INIT_DEQUE_CAPACITY];
+        long head = atomic_load_explicit(&deq->head, memory_order_acquire);
+        atomic_thread_fence(memory_order_seq_cst);
+        const long tail = atomic_load_explicit(&deq->tail,
+                memory_order_acquire);
+
+        success = 0;
+        if (nstolen == 0 && (tail - head + 1) / 2 < max_steal) {
+            max_steal = (int)((tail - head + 1) / 2);
+        }
+
+        if (tail - head > 0) {
+            /*
+             * The slot must be read after head and tail. If it were read
+             * earlier, the owner could push into an empty deque in between and
+             * we would return the stale contents of the slot.
+             */
+            hclib_deque_buffer_t *buf = atomic_load_explicit(&deq->buffer,
+                    memory_order_acquire);
+            hclib_task_t *t = deque_buffer_get(buf, head);
             /* compete with other thieves and possibly the owner (if the size == 1) */
-            const int old = hc_cas(&deq->head, head, head + 1);
-            if (old == head) {
+            if (atomic_compare_exchange_strong_explicit(&deq->head, &head,
+                        head + 1, memory_order_seq_cst,
+                        memory_order_relaxed)) {
                 success = 1;
                 stolen[nstolen++] = t;
             }
-
         }
-    } while (success && nstolen < STEAL_CHUNK_SIZE);
+    } while (success && nstolen < max_steal);
 
     return nstolen;
 }
@@ -109,37 +213,125 @@ int deque_steal(hclib_internal_deque_t *deq, void **stolen) {
  * pop the task out of the deque from the tail
  */
 hclib_task_t *deque_pop(hclib_internal_deque_t *deq) {
-    hc_mfence();
-    int tail = deq->tail;
-    tail--;
-    deq->tail = tail;
-    hc_mfence();
-    int head = deq->head;
-
-    int size = tail - head;
-    if (size < 0) {
-        deq->tail = deq->head;
+    const long tail = atomic_load_explicit(&deq->tail,
+            memory_order_relaxed) - 1;
+    hclib_deque_buffer_t *buf = atomic_load_explicit(&deq->buffer,
+            memory_order_relaxed);
+    atomic_store_explicit(&deq->tail, tail, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long head = atomic_load_explicit(&deq->head, memory_order_relaxed);
+
+    if (tail - head < 0) {
+        /* deque was already empty */
+        atomic_store_explicit(&deq->tail, tail + 1, memory_order_relaxed);
         return NULL;
     }
-    hclib_task_t *t = (hclib_task_t *) deq->data[tail % INIT_DEQUE_CAPACITY];
 
-    if (size > 0) {
+    hclib_task_t *t = deque_buffer_get(buf, tail);
+    if (tail - head > 0) {
         return t;
     }
 
     /* now size == 1, I need to compete with the thieves */
-    const int old = hc_cas(&deq->head, head, head + 1);
-    if (old != head) {
+    if (!atomic_compare_exchange_strong_explicit(&deq->head, &head, head + 1,
+                memory_order_seq_cst, memory_order_relaxed)) {
         t = NULL;
     }
 
     /* now the deque is empty */
-    deq->tail = deq->head;
+    atomic_store_explicit(&deq->tail, tail + 1, memory_order_relaxed);
     return t;
 }
 
+/*
+ * Owner-only variants of the above, for deques in private mode (see
+ * HCLIB_PRIVATE_DEQUES). Thieves never access a private deque, they ask its
+ * owner for tasks instead and the owner hands them over with
+ * deque_take_private. No fences or CAS are needed. Head and tail are still
+ * stored atomically so that other workers can read deque_size.
+ */
+void deque_push_private(hclib_internal_deque_t *deq, void *entry) {
+    const long tail = atomic_load_explicit(&deq->tail, memory_order_relaxed);
+    const long head = atomic_load_explicit(&deq->head, memory_order_relaxed);
+    hclib_deque_buffer_t *buf = deque_reserve(deq, head, tail, 1);
+    deque_buffer_put(buf, tail, (hclib_task_t *)entry);
+    atomic_store_explicit(&deq->tail, tail + 1, memory_order_relaxed);
+}
+
+void deque_push_batch_private(hclib_internal_deque_t *deq, void **entries,
+        int n) {
+    const long tail = atomic_load_explicit(&deq->tail, memory_order_relaxed);
+    const long head = atomic_load_explicit(&deq->head, memory_order_relaxed);
+    int i;
+
+    if (n <= 0) return;
+
+    hclib_deque_buffer_t *buf = deque_reserve(deq, head, tail, n);
+    for (i = 0; i < n; i++) {
+        deque_buffer_put(buf, tail + i, (hclib_task_t *)entries[i]);
+    }
+    atomic_store_explicit(&deq->tail, tail + n, memory_order_relaxed);
+}
+
+hclib_task_t *deque_pop_private(hclib_internal_deque_t *deq) {
+    const long tail = atomic_load_explicit(&deq->tail, memory_order_relaxed);
+    const long head = atomic_load_explicit(&deq->head, memory_order_relaxed);
+
+    if (tail == head) return NULL;
+
+    hclib_deque_buffer_t *buf = atomic_load_explicit(&deq->buffer,
+            memory_order_relaxed);
+    atomic_store_explicit(&deq->tail, tail - 1, memory_order_relaxed);
+    return deque_buffer_get(buf, tail - 1);
+}
+
+/*
+ * Remove up to max_steal of the oldest tasks from a private deque on behalf of
+ * a thief, and no more than half of them (rounded up), like deque_steal.
+ */
+int deque_take_private(hclib_internal_deque_t *deq, void **stolen,
+        int max_steal) {
+    const long tail = atomic_load_explicit(&deq->tail, memory_order_relaxed);
+    const long head = atomic_load_explicit(&deq->head, memory_order_relaxed);
+    hclib_deque_buffer_t *buf = atomic_load_explicit(&deq->buffer,
+            memory_order_relaxed);
+    int i;
+
+    if ((tail - head + 1) / 2 < max_steal) {
+        max_steal = (int)((tail - head + 1) / 2);
+    }
+    for (i = 0; i < max_steal; i++) {
+        stolen[i] = deque_buffer_get(buf, head + i);
+    }
+    atomic_store_explicit(&deq->head, head + max_steal, memory_order_relaxed);
+    return max_steal;
+}
+
 unsigned deque_size(hclib_internal_deque_t *deq) {
-    const int size = deq->tail - deq->head;
+    const long head = atomic_load_explicit(&deq->head, memory_order_relaxed);
+    const long tail = atomic_load_explicit(&deq->tail, memory_order_relaxed);
+    const long size = tail - head;
     if (size <= 0) return 0;
     else return (unsigned)size;
 }
+
+unsigned deque_capacity(hclib_internal_deque_t *deq) {
+    hclib_deque_buffer_t *buf = atomic_load_explicit(&deq->buffer,
+            memory_order_acquire);
+    return buf ? (unsigned)buf->capacity : 0;
+}
+
+/*
+ * Number of bytes of task buffers currently held by this deque, including
+ * retired buffers.
+ */
+size_t deque_footprint(hclib_internal_deque_t *deq) {
+    size_t nbytes = 0;
+    hclib_deque_buffer_t *buf = atomic_load_explicit(&deq->buffer,
+            memory_order_acquire);
+    while (buf) {
+        nbytes += sizeof(*buf) + buf->capacity * sizeof(buf->data[0]);
+        buf = buf->prev;
+    }
+    return nbytes;
+}
@@ -0,0 +1,115 @@
+/* Copyright (c) 2015, Rice University
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1.  Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+2.  Redistributions in binary form must reproduce the above
+     copyright notice, this list of conditions and the following
+     disclaimer in the documentation and/or other materials provided
+     with the distribution.
+3.  Neither the name of Rice University
+     nor the names of its contributors may be used to endorse or
+     promote products derived from this software without specific
+     prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+/*
+ * hclib-eventcount.c
+ *
+ * Sleeping and waking for hclib_eventcount_t, see hclib-eventcount.h. Uses a
+ * futex on the epoch on Linux, and a mutex/condition variable pair elsewhere.
+ */
+
+#include <limits.h>
+
+#include "hclib-eventcount.h"
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static inline void futex_wait(_Atomic unsigned *addr, unsigned val) {
+    syscall(SYS_futex, (unsigned *)addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL,
+            0);
+}
+
+static inline void futex_wake(_Atomic unsigned *addr, int nwake) {
+    syscall(SYS_futex, (unsigned *)addr, FUTEX_WAKE_PRIVATE, nwake, NULL, NULL,
+            0);
+}
+#endif
+
+void hclib_ec_init(hclib_eventcount_t *ec) {
+    atomic_init(&ec->epoch, 0);
+    atomic_init(&ec->nsleepers, 0);
+    atomic_init(&ec->nflag_sleepers, 0);
+#ifndef __linux__
+    pthread_mutex_init(&ec->lock, NULL);
+    pthread_cond_init(&ec->cond, NULL);
+#endif
+}
+
+void hclib_ec_destroy(hclib_eventcount_t *ec) {
+#ifndef __linux__
+    pthread_mutex_destroy(&ec->lock);
+    pthread_cond_destroy(&ec->cond);
+#endif
+}
+
+/*
+ * Sleep until the epoch is no longer key, which must come from a preceding
+ * hclib_ec_prepare_wait. May return spuriously.
+ */
+void hclib_ec_wait(hclib_eventcount_t *ec, unsigned key, int on_flag) {
+#ifdef __linux__
+    if (atomic_load(&ec->epoch) == key) {
+        futex_wait(&ec->epoch, key);
+    }
+#else
+    pthread_mutex_lock(&ec->lock);
+    while (atomic_load(&ec->epoch) == key) {
+        pthread_cond_wait(&ec->cond, &ec->lock);
+    }
+    pthread_mutex_unlock(&ec->lock);
+#endif
+    hclib_ec_cancel_wait(ec, on_flag);
+}
+
+/*
+ * Advance the epoch and wake up to nwake sleepers, or all of them if nwake is
+ * negative.
+ */
+void hclib_ec_wake(hclib_eventcount_t *ec, int nwake) {
+#ifdef __linux__
+    atomic_fetch_add(&ec->epoch, 1);
+    futex_wake(&ec->epoch, nwake < 0 ? INT_MAX : nwake);
+#else
+    pthread_mutex_lock(&ec->lock);
+    atomic_fetch_add(&ec->epoch, 1);
+    if (nwake < 0) {
+        pthread_cond_broadcast(&ec->cond);
+    } else {
+        while (nwake-- > 0) {
+            pthread_cond_signal(&ec->cond);
+        }
+    }
+    pthread_mutex_unlock(&ec->lock);
+#endif
+}
@@ -33,7 +33,12 @@ void hclib_register_func(hclib_fptr_list_t **list, int index, void *fptr,
         (*list)->capacity = needed_capacity;
     }
 
-    HASSERT(((*list)->fptrs)[index] == NULL);
+    /*
+     * Modules register their functions again each time the runtime is
+     * initialized, which is fine as long as they agree with the last time.
+     */
+    HASSERT(((*list)->fptrs)[index] == NULL ||
+            ((*list)->fptrs)[index] == fptr);
     ((*list)->fptrs)[index] = fptr;
     ((*list)->priorities)[index] = priority;
 }
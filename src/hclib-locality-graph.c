@@ -4,6 +4,7 @@
 #include "hclib-internal.h"
 #include "hclib-module.h"
 #include "hclib-fptr-list.h"
+#include "hclib-atomics.h"
 
 #include <stdio.h>
 #include <assert.h>
@@ -22,6 +23,18 @@ static unsigned n_known_locale_types = 0;
 static hclib_fptr_list_t *metadata_size_registrations = NULL;
 static hclib_fptr_list_t *metadata_populate_registrations = NULL;
 
+typedef struct _arena_decl_t {
+    char *name;
+    int *workers;
+    int nworkers;
+} arena_decl_t;
+
+// Arenas declared with hclib_declare_arena, set up by every launch
+static arena_decl_t *declared_arenas = NULL;
+static int n_declared_arenas = 0;
+
+#define ARENA_LBL_PREFIX "arena_"
+
 // Add a known locale type to the list of known locale types.
 unsigned hclib_add_known_locale_type(const char *lbl) {
     int i;
@@ -307,11 +320,16 @@ static int parse_paths(int starting_token_index, int n_paths, char *json,
 }
 
 static inline void init_hclib_deque_t(hclib_deque_t *hcdeq, hclib_locale_t *locale) {
-    hcdeq->deque.head = hcdeq->deque.tail = 0;
+    int i;
+    deque_init(&hcdeq->deque, NULL);
+    for (i = 0; i < HCLIB_NUM_PRIORITIES - 1; i++) {
+        deque_init(hcdeq->prio_lanes + i, NULL);
+    }
     hcdeq->locale = locale;
     hcdeq->ws = NULL;
     hcdeq->nnext = NULL;
     hcdeq->prev = NULL;
+    hcdeq->is_private = 0;
 #ifdef BUCKET_DEQUE
     hcdeq->deque.last = 0;
     hcdeq->deque.thief = 0;
@@ -319,6 +337,21 @@ static inline void init_hclib_deque_t(hclib_deque_t *hcdeq, hclib_locale_t *loca
 #endif
 }
 
+static int default_steal_batch() {
+    const char *steal_batch_str = getenv("HCLIB_STEAL_BATCH");
+    if (steal_batch_str == NULL) {
+        return DEFAULT_STEAL_BATCH;
+    }
+
+    const int steal_batch = atoi(steal_batch_str);
+    if (steal_batch < 1 || steal_batch > STEAL_CHUNK_SIZE) {
+        fprintf(stderr, "HCLIB_STEAL_BATCH must be between 1 and %d, got "
+                "\"%s\"\n", STEAL_CHUNK_SIZE, steal_batch_str);
+        exit(1);
+    }
+    return steal_batch;
+}
+
 static void initialize_locale(hclib_locale_t *locale, int id, const char *lbl,
         int nworkers) {
     int i;
@@ -345,9 +378,17 @@ static void initialize_locale(hclib_locale_t *locale, int id, const char *lbl,
     locale->special_type = NULL;
     locale->idle_funcs = NULL;
     locale->n_idle_funcs = 0;
-    locale->deques = (hclib_deque_t *)calloc(nworkers,
-            sizeof(*(locale->deques)));
-    assert(locale->deques);
+    locale->steal_batch = default_steal_batch();
+    locale->is_arena = 0;
+    locale->injected = NULL;
+    /*
+     * Each deque keeps its head and tail on separate cache lines, so the array
+     * needs to be cache line aligned for that to hold.
+     */
+    const int err = posix_memalign((void **)&locale->deques, HCLIB_CACHE_LINE,
+            nworkers * sizeof(*(locale->deques)));
+    assert(err == 0 && locale->deques);
+    memset(locale->deques, 0x00, nworkers * sizeof(*(locale->deques)));
     for (i = 0; i < nworkers; i++) {
         hclib_deque_t *deq = locale->deques + i;
         init_hclib_deque_t(deq, locale);
@@ -366,6 +407,121 @@ static void initialize_locale(hclib_locale_t *locale, int id, const char *lbl,
     }
 }
 
+static void add_arena_decl(arena_decl_t **arenas, int *narenas, char *name,
+        int *workers, int nworkers) {
+    *arenas = (arena_decl_t *)realloc(*arenas,
+            (*narenas + 1) * sizeof(arena_decl_t));
+    assert(*arenas);
+    (*arenas)[*narenas].name = name;
+    (*arenas)[*narenas].workers = workers;
+    (*arenas)[*narenas].nworkers = nworkers;
+    *narenas += 1;
+}
+
+void hclib_declare_arena(const char *name, const int *worker_ids,
+        int nworkers) {
+    HASSERT(hc_context == NULL &&
+            "arenas must be declared before the runtime starts");
+    HASSERT(nworkers > 0);
+
+    char *name_copy = (char *)malloc(strlen(name) + 1);
+    int *workers = (int *)malloc(nworkers * sizeof(int));
+    assert(name_copy && workers);
+    memcpy(name_copy, name, strlen(name) + 1);
+    memcpy(workers, worker_ids, nworkers * sizeof(int));
+    add_arena_decl(&declared_arenas, &n_declared_arenas, name_copy, workers,
+            nworkers);
+}
+
+/*
+ * Copy the arenas declared through hclib_declare_arena, for the locality
+ * loaders to add those from the locality file to.
+ */
+static arena_decl_t *copy_declared_arenas(int *narenas_out) {
+    arena_decl_t *arenas = NULL;
+    int narenas = 0;
+    int i;
+    for (i = 0; i < n_declared_arenas; i++) {
+        arena_decl_t *decl = declared_arenas + i;
+        char *name = (char *)malloc(strlen(decl->name) + 1);
+        int *workers = (int *)malloc(decl->nworkers * sizeof(int));
+        assert(name && workers);
+        memcpy(name, decl->name, strlen(decl->name) + 1);
+        memcpy(workers, decl->workers, decl->nworkers * sizeof(int));
+        add_arena_decl(&arenas, &narenas, name, workers, decl->nworkers);
+    }
+    *narenas_out = narenas;
+    return arenas;
+}
+
+static void set_single_locale_path(hclib_locality_path *path,
+        hclib_locale_t *locale) {
+    path->locales = (hclib_locale_t **)realloc(path->locales,
+            sizeof(hclib_locale_t *));
+    assert(path->locales);
+    path->locales[0] = locale;
+    path->path_length = 1;
+}
+
+/*
+ * Initialize the locales of the given arenas, which the caller reserved at
+ * the end of the graph from first_locale on, and restrict the paths of their
+ * workers to them. Releases the arena declarations.
+ */
+static void setup_arenas(hclib_locality_graph *graph, int first_locale,
+        arena_decl_t *arenas, int narenas, hclib_worker_paths *worker_paths,
+        int nworkers) {
+    int i, j;
+
+    if (narenas > 0) {
+        hclib_add_known_locale_type("arena");
+    }
+
+    for (i = 0; i < narenas; i++) {
+        arena_decl_t *decl = arenas + i;
+        hclib_locale_t *locale = graph->locales + first_locale + i;
+
+        for (j = 0; j < i; j++) {
+            if (strcmp(arenas[j].name, decl->name) == 0) {
+                fprintf(stderr, "Arena \"%s\" declared more than once\n",
+                        decl->name);
+                exit(1);
+            }
+        }
+
+        char *lbl = (char *)malloc(strlen(ARENA_LBL_PREFIX) +
+                strlen(decl->name) + 1);
+        assert(lbl);
+        sprintf(lbl, ARENA_LBL_PREFIX "%s", decl->name);
+        initialize_locale(locale, first_locale + i, lbl, nworkers);
+        locale->is_arena = 1;
+
+        for (j = 0; j < decl->nworkers; j++) {
+            const int wid = decl->workers[j];
+            if (wid <= 0 || wid >= nworkers) {
+                fprintf(stderr, "Worker %d of arena \"%s\" is not between 1 "
+                        "and %d, worker 0 runs the root task and can not be "
+                        "part of an arena\n", wid, decl->name, nworkers - 1);
+                exit(1);
+            }
+            hclib_worker_paths *paths = worker_paths + wid;
+            if (paths->arena) {
+                fprintf(stderr, "Worker %d is part of both arena \"%s\" and "
+                        "\"%s\"\n", wid, paths->arena->lbl +
+                        strlen(ARENA_LBL_PREFIX), decl->name);
+                exit(1);
+            }
+            paths->arena = locale;
+            set_single_locale_path(paths->pop_path, locale);
+            set_single_locale_path(paths->steal_path, locale);
+        }
+
+        free(decl->name);
+        free(decl->workers);
+    }
+    free(arenas);
+}
+
 /*
  * See locality_graphs/davinci.json for an example locality graph.
  */
@@ -427,6 +583,34 @@ void load_locality_info(const char *filename, int *nworkers_out,
         nworkers = new_nworkers;
     }
 
+    // Optional arenas, mapping arena names to lists of worker IDs
+    int narenas;
+    arena_decl_t *arenas = copy_declared_arenas(&narenas);
+    if (string_token_equals(tokens + token_index, json, "arenas") == 0) {
+        token_index++;
+        assert(tokens[token_index].type == JSMN_OBJECT);
+        const int n_json_arenas = tokens[token_index].size;
+        token_index++;
+
+        for (i = 0; i < n_json_arenas; i++) {
+            char *name = get_copy_of_string_token(tokens + token_index, json);
+            token_index++;
+            assert(tokens[token_index].type == JSMN_ARRAY);
+            const int arena_nworkers = tokens[token_index].size;
+            token_index++;
+
+            int *workers = (int *)malloc(arena_nworkers * sizeof(int));
+            assert(workers);
+            int j;
+            for (j = 0; j < arena_nworkers; j++) {
+                workers[j] = parse_int_from_primitive(tokens + token_index + j,
+                        json);
+            }
+            token_index += arena_nworkers;
+            add_arena_decl(&arenas, &narenas, name, workers, arena_nworkers);
+        }
+    }
+
     // Declarations field of top-level object
     assert(string_token_equals(tokens + token_index, json, "declarations") == 0);
     token_index++;
@@ -434,8 +618,12 @@ void load_locality_info(const char *filename, int *nworkers_out,
     const int nlocales = tokens[token_index].size;
     token_index++;
 
-    // Initialize locales array from the array of declared locales
-    hclib_locale_t *locales = (hclib_locale_t *)malloc(nlocales *
+    /*
+     * Initialize locales array from the array of declared locales, leaving
+     * room for the arenas at the end.
+     */
+    const int n_all_locales = nlocales + narenas;
+    hclib_locale_t *locales = (hclib_locale_t *)malloc(n_all_locales *
             sizeof(hclib_locale_t));
     assert(locales);
     for (i = token_index; i < token_index + nlocales; i++) {
@@ -458,10 +646,12 @@ void load_locality_info(const char *filename, int *nworkers_out,
     hclib_locality_graph *graph = (hclib_locality_graph *)malloc(sizeof(hclib_locality_graph));
     assert(graph);
     graph->locales = locales;
-    graph->n_locales = nlocales;
-    graph->edges = (unsigned *)malloc(nlocales * nlocales * sizeof(unsigned));
+    graph->n_locales = n_all_locales;
+    graph->edges = (unsigned *)malloc(n_all_locales * n_all_locales *
+            sizeof(unsigned));
     assert(graph->edges);
-    memset(graph->edges, 0x00, nlocales * nlocales * sizeof(unsigned));
+    memset(graph->edges, 0x00, n_all_locales * n_all_locales *
+            sizeof(unsigned));
 
     // list of reachability edges
     assert(string_token_equals(tokens + token_index, json, "reachability") == 0);
@@ -495,8 +685,8 @@ void load_locality_info(const char *filename, int *nworkers_out,
         }
         edge_index++;
 
-        graph->edges[locale1->id * nlocales + locale2->id] = 1;
-        graph->edges[locale2->id * nlocales + locale1->id] = 1;
+        graph->edges[locale1->id * n_all_locales + locale2->id] = 1;
+        graph->edges[locale2->id * n_all_locales + locale1->id] = 1;
     }
     token_index = edge_index;
 
@@ -555,6 +745,8 @@ void load_locality_info(const char *filename, int *nworkers_out,
     free(worker_pop_paths);
     free(worker_steal_paths);
 
+    setup_arenas(graph, nlocales, arenas, narenas, worker_paths, nworkers);
+
     /*
      * Final output is the locality graph that depicts the hardware layout of
      * the node (graph) and the set of paths for each worker to traverse when
@@ -594,16 +786,21 @@ void generate_locality_info(int *nworkers_out,
                 "default of %u\n", nworkers);
     }
 
+    int narenas;
+    arena_decl_t *arenas = copy_declared_arenas(&narenas);
+
     hclib_locality_graph *graph = (hclib_locality_graph *)malloc(
             sizeof(hclib_locality_graph));
     assert(graph);
-    graph->n_locales = 1 + nworkers;
+    graph->n_locales = 1 + nworkers + narenas;
     graph->locales = (hclib_locale_t *)malloc(graph->n_locales *
             sizeof(hclib_locale_t));
     assert(graph->locales);
     graph->edges = (unsigned *)malloc(graph->n_locales * graph->n_locales *
             sizeof(unsigned));
     assert(graph->edges);
+    memset(graph->edges, 0x00, graph->n_locales * graph->n_locales *
+            sizeof(unsigned));
 
     hclib_worker_paths *worker_paths = (hclib_worker_paths *)calloc(nworkers,
             sizeof(*worker_paths));
@@ -637,17 +834,56 @@ void generate_locality_info(int *nworkers_out,
         worker_paths[i - 1].steal_path->locales[1] = graph->locales + 0;
     }
 
+    setup_arenas(graph, 1 + nworkers, arenas, narenas, worker_paths, nworkers);
+
     *nworkers_out = nworkers;
     *graph_out = graph;
     *worker_paths_out = worker_paths;
 }
 
+/*
+ * Release everything allocated by load_locality_info or generate_locality_info,
+ * including the buffers of any deques that were materialized since.
+ */
+void free_locality_info(hclib_locality_graph *graph,
+        hclib_worker_paths *worker_paths, int nworkers) {
+    int i, j, k;
+
+    for (i = 0; i < nworkers; i++) {
+        free(worker_paths[i].pop_path->locales);
+        free(worker_paths[i].pop_path);
+        free(worker_paths[i].steal_path->locales);
+        free(worker_paths[i].steal_path);
+    }
+    free(worker_paths);
+
+    for (i = 0; i < graph->n_locales; i++) {
+        hclib_locale_t *locale = graph->locales + i;
+        for (j = 0; j < nworkers; j++) {
+            hclib_deque_t *deq = locale->deques + j;
+            deque_destroy(&deq->deque);
+            for (k = 0; k < HCLIB_NUM_PRIORITIES - 1; k++) {
+                deque_destroy(deq->prio_lanes + k);
+            }
+        }
+        free(locale->deques);
+        free(locale->metadata);
+        free(locale->idle_funcs);
+        free((char *)locale->lbl);
+    }
+    free(graph->locales);
+    free(graph->edges);
+    free(graph);
+}
+
 void check_locality_graph(hclib_locality_graph *graph,
         hclib_worker_paths *worker_paths, int nworkers) {
     int i;
 
     for (i = 0; i < graph->n_locales; i++) {
         graph->locales[i].reachable = 0;
+        graph->locales[i].n_thieves = 0;
+        graph->locales[i].first_thief = nworkers;
     }
 
     for (i = 0; i < nworkers; i++) {
@@ -657,7 +893,16 @@ void check_locality_graph(hclib_locality_graph *graph,
             curr->pop_path->locales[j]->reachable = 1;
         }
         for (j = 0; j < curr->steal_path->path_length; j++) {
-            curr->steal_path->locales[j]->reachable = 1;
+            hclib_locale_t *locale = curr->steal_path->locales[j];
+            int k;
+            locale->reachable = 1;
+            for (k = 0; k < j && curr->steal_path->locales[k] != locale; k++) ;
+            if (k == j) {
+                locale->n_thieves++;
+            }
+            if (locale->first_thief > i) {
+                locale->first_thief = i;
+            }
         }
         // Check appropriately initialized
         assert(curr->last_successful_steal_locale == 0);
@@ -714,6 +959,160 @@ void print_worker_paths(hclib_worker_paths *worker_paths, int nworkers) {
     printf("\n");
 }
 
+static inline unsigned next_steal_rand(hclib_worker_state *ws) {
+    // xorshift32, never reaches zero from a non-zero seed
+    unsigned x = ws->steal_rand;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    ws->steal_rand = x;
+    return x;
+}
+
+/*
+ * Number of hops from the given locale to every other locale in the graph,
+ * found with a breadth-first traversal of its edges. Locales that cannot be
+ * reached are given a distance of n_locales.
+ */
+static void locale_hop_distances(hclib_locality_graph *graph,
+        hclib_locale_t *from, int *dists) {
+    int i;
+    const int n_locales = graph->n_locales;
+    int *to_visit = (int *)malloc(n_locales * sizeof(int));
+    assert(to_visit);
+
+    for (i = 0; i < n_locales; i++) {
+        dists[i] = n_locales;
+    }
+    dists[from->id] = 0;
+    to_visit[0] = from->id;
+    int visiting_index = 0;
+    int to_visit_index = 1;
+
+    while (visiting_index < to_visit_index) {
+        const int id = to_visit[visiting_index++];
+        for (i = 0; i < n_locales; i++) {
+            if (graph->edges[id * n_locales + i] && dists[i] == n_locales) {
+                dists[i] = dists[id] + 1;
+                to_visit[to_visit_index++] = i;
+            }
+        }
+    }
+
+    free(to_visit);
+}
+
+/*
+ * Build the order in which each worker visits victims when stealing. Workers
+ * are placed at the first locale on their pop path, and victims are grouped by
+ * the hop distance between the thief's and victim's locales. If hwloc found a
+ * range of workers sharing a NUMA node with the thief, those come before the
+ * others at the same distance. Each group is shuffled per thief so that
+ * thieves do not all converge on the same low-numbered victims.
+ *
+ * Must be called after the intra-socket worker ranges have been filled in.
+ */
+void build_victim_orders(hclib_worker_state **workers, int nworkers,
+        hclib_locality_graph *graph) {
+    int i, j;
+    int *dists = (int *)malloc(graph->n_locales * sizeof(int));
+    int *keys = (int *)malloc(nworkers * sizeof(int));
+    assert(dists && keys);
+
+    for (i = 0; i < nworkers; i++) {
+        hclib_worker_state *ws = workers[i];
+        const int has_socket_info = ws->base_intra_socket_workers <
+            ws->limit_intra_socket_workers;
+
+        ws->steal_rand = 2654435761u * (i + 1);
+        ws->last_victim = -1;
+        ws->steal_victims = (int *)malloc(nworkers * sizeof(int));
+        ws->victim_tier_ends = (int *)malloc(nworkers * sizeof(int));
+        assert(ws->steal_victims && ws->victim_tier_ends);
+
+        locale_hop_distances(graph, ws->paths->pop_path->locales[0], dists);
+        for (j = 0; j < nworkers; j++) {
+            const int same_socket = !has_socket_info ||
+                (j >= ws->base_intra_socket_workers &&
+                 j < ws->limit_intra_socket_workers);
+            keys[j] = 2 * dists[workers[j]->paths->pop_path->locales[0]->id] +
+                (same_socket ? 0 : 1);
+        }
+
+        // Insertion sort of worker IDs by key, nworkers is small
+        for (j = 0; j < nworkers; j++) {
+            int k = j;
+            while (k > 0 && keys[ws->steal_victims[k - 1]] > keys[j]) {
+                ws->steal_victims[k] = ws->steal_victims[k - 1];
+                k--;
+            }
+            ws->steal_victims[k] = j;
+        }
+
+        ws->n_victim_tiers = 0;
+        int tier_start = 0;
+        for (j = 1; j <= nworkers; j++) {
+            if (j == nworkers || keys[ws->steal_victims[j]] !=
+                    keys[ws->steal_victims[tier_start]]) {
+                // Fisher-Yates shuffle of the tier [tier_start, j)
+                int k;
+                for (k = j - 1; k > tier_start; k--) {
+                    const int other = tier_start +
+                        next_steal_rand(ws) % (k - tier_start + 1);
+                    const int tmp = ws->steal_victims[k];
+                    ws->steal_victims[k] = ws->steal_victims[other];
+                    ws->steal_victims[other] = tmp;
+                }
+                ws->victim_tier_ends[ws->n_victim_tiers++] = j;
+                tier_start = j;
+            }
+        }
+
+#ifdef VERBOSE
+        fprintf(stderr, "Worker %d steals from", i);
+        int tier = 0;
+        for (j = 0; j < nworkers; j++) {
+            fprintf(stderr, " %d", ws->steal_victims[j]);
+            if (j + 1 == ws->victim_tier_ends[tier]) {
+                fprintf(stderr, " |");
+                tier++;
+            }
+        }
+        fprintf(stderr, "\n");
+#endif
+    }
+
+    free(keys);
+    free(dists);
+}
+
+void free_victim_orders(hclib_worker_state **workers, int nworkers) {
+    int i;
+    for (i = 0; i < nworkers; i++) {
+        free(workers[i]->steal_victims);
+        free(workers[i]->victim_tier_ends);
+        workers[i]->steal_victims = NULL;
+        workers[i]->victim_tier_ends = NULL;
+        workers[i]->n_victim_tiers = 0;
+    }
+}
+
+/*
+ * In private deque mode, each worker's deques along its pop path are only ever
+ * touched by that worker. Its deques at other locales, which it only pushes to
+ * for tasks explicitly spawned there, stay shared with thieves: the worker
+ * never pops them, so it could not be relied on to hand their tasks out.
+ */
+void mark_private_deques(hclib_worker_paths *worker_paths, int nworkers) {
+    int i, j;
+    for (i = 0; i < nworkers; i++) {
+        hclib_locality_path *pop = worker_paths[i].pop_path;
+        for (j = 0; j < pop->path_length; j++) {
+            pop->locales[j]->deques[i].is_private = 1;
+        }
+    }
+}
+
 /*
  * *************************************************
  *                  Runtime code
@@ -736,7 +1135,180 @@ int deque_push_locale(hclib_worker_state *ws, hclib_locale_t *locale,
         void *ele) {
     assert(locale->reachable);
     hclib_deque_t *deq = get_deque_locale(ws, locale);
-    return deque_push(&deq->deque, ele);
+    const int priority = ((hclib_task_t *)ele)->priority;
+    hclib_internal_deque_t *lane = deque_lane(deq, priority);
+    if (priority != HCLIB_PRIORITY_DEFAULT) {
+        ws->prio_tasks++;
+    }
+    if (deq->is_private) {
+        deque_push_private(lane, ele);
+        // Spawning a task is one of the points where we answer thieves
+        answer_steal_request(ws);
+        return 1;
+    }
+    return deque_push(lane, ele);
+}
+
+/*
+ * Push n tasks of the same priority at once onto the deque for this thread at
+ * the specified locale.
+ */
+void deque_push_batch_locale(hclib_worker_state *ws, hclib_locale_t *locale,
+        void **eles, int n) {
+    assert(locale->reachable);
+    hclib_deque_t *deq = get_deque_locale(ws, locale);
+    const int priority = ((hclib_task_t *)eles[0])->priority;
+    hclib_internal_deque_t *lane = deque_lane(deq, priority);
+    if (priority != HCLIB_PRIORITY_DEFAULT) {
+        ws->prio_tasks += n;
+    }
+    if (deq->is_private) {
+        deque_push_batch_private(lane, eles, n);
+        answer_steal_request(ws);
+    } else {
+        deque_push_batch(lane, eles, n);
+    }
+}
+
+/*
+ * Hand a ready task to the workers that steal from locale. Safe to call from
+ * any thread, including ones that are not HClib workers and so have no deque
+ * to push to. As in rt_schedule_async, a NULL locale means locale 0. Tasks are
+ * linked through next_waiter, which is free once a task no longer waits on
+ * any future.
+ */
+void locale_inject_task(hclib_locale_t *locale, hclib_task_t *task) {
+    if (locale == NULL) {
+        locale = hc_context->graph->locales + 0;
+    }
+    HASSERT(locale->n_thieves > 0);
+    hclib_task_t *head;
+    do {
+        head = locale->injected;
+        task->next_waiter = head;
+    } while (!__sync_bool_compare_and_swap(&locale->injected, head, task));
+
+    notify_tasks_at(locale, 1);
+}
+
+/*
+ * Take all tasks injected at locale. The oldest one is stored in *oldest for
+ * the caller to run, unless it already holds a task, and the others are pushed
+ * to our deque at locale in the order they were injected, so that thieves help
+ * with them. Any number of workers may drain concurrently, since each takes a
+ * whole list at once.
+ */
+static void drain_injected_at(hclib_worker_state *ws, hclib_locale_t *locale,
+        hclib_task_t **oldest) {
+    hclib_task_t *task = __sync_lock_test_and_set(&locale->injected, NULL);
+    // Reverse the list, so that it starts with the oldest task
+    hclib_task_t *reversed = NULL;
+    while (task) {
+        hclib_task_t *next = task->next_waiter;
+        task->next_waiter = reversed;
+        reversed = task;
+        task = next;
+    }
+
+    int npushed = 0;
+    for (task = reversed; task; task = reversed) {
+        reversed = task->next_waiter;
+        task->next_waiter = NULL;
+        if (*oldest == NULL) {
+            *oldest = task;
+        } else {
+            deque_push_locale(ws, locale, task);
+            npushed++;
+        }
+    }
+    if (npushed) {
+        notify_tasks_at(locale, npushed);
+    }
+}
+
+// Take all tasks injected at the locales on our steal path, see above
+hclib_task_t *locale_drain_injected(hclib_worker_state *ws) {
+    hclib_locality_path *steal = ws->paths->steal_path;
+    hclib_task_t *oldest = NULL;
+    int i;
+
+    for (i = 0; i < steal->path_length; i++) {
+        hclib_locale_t *locale = steal->locales[i];
+        if (locale->injected != NULL) {
+            drain_injected_at(ws, locale, &oldest);
+        }
+    }
+    return oldest;
+}
+
+/*
+ * Take up to max_steal of the oldest tasks from the highest priority non-empty
+ * lane of a private deque, on behalf of a thief.
+ */
+static int take_lanes_private(hclib_deque_t *deq, void **stolen,
+        int max_steal) {
+    int priority;
+    for (priority = HCLIB_PRIORITY_MAX; priority > HCLIB_PRIORITY_DEFAULT;
+            priority--) {
+        hclib_internal_deque_t *lane = deque_lane(deq, priority);
+        if (deque_size(lane) == 0) continue;
+        return deque_take_private(lane, stolen, max_steal);
+    }
+    return deque_take_private(&deq->deque, stolen, max_steal);
+}
+
+/*
+ * Steal from the highest priority non-empty lane of a shared deque. Lanes that
+ * never had anything pushed to them are skipped by only looking at their
+ * buffer, which shares a cache line with their tail.
+ */
+static int steal_lanes(hclib_deque_t *deq, void **stolen, int max_steal) {
+    int priority;
+    for (priority = HCLIB_PRIORITY_MAX; priority > HCLIB_PRIORITY_DEFAULT;
+            priority--) {
+        hclib_internal_deque_t *lane = deque_lane(deq, priority);
+        if (atomic_load_explicit(&lane->buffer, memory_order_relaxed) ==
+                NULL || deque_size(lane) == 0) {
+            continue;
+        }
+        const int nstolen = deque_steal(lane, stolen, max_steal);
+        if (nstolen) return nstolen;
+    }
+    return deque_steal(&deq->deque, stolen, max_steal);
+}
+
+/*
+ * Hand a thief waiting on this worker the oldest tasks from our private deque
+ * at the locale it asked for, if any. Called through answer_steal_request,
+ * i.e. only by the owner of the deques.
+ */
+void answer_steal_request_slow(hclib_worker_state *ws) {
+    const int request = ws->steal_request;
+    if (request <= 0 || !__sync_bool_compare_and_swap(&ws->steal_request,
+                request, -1)) {
+        // The thief gave up on us in the meantime
+        return;
+    }
+
+    hclib_worker_state *thief = hc_context->workers[request - 1];
+    hclib_locale_t *locale = thief->steal_locale;
+    hclib_deque_t *deq = get_deque_locale(ws, locale);
+    int nstolen = 0;
+    if (deq->is_private) {
+        /*
+         * Producers that already ran inline are left in our deques for us to
+         * release, handing them over would leave the thief with nothing to run.
+         */
+        do {
+            nstolen = take_lanes_private(deq, thief->steal_buffer,
+                    locale->steal_batch);
+            nstolen = release_ran_inline((hclib_task_t **)thief->steal_buffer,
+                    nstolen);
+        } while (nstolen == 0 && hclib_deque_size(deq) > 0);
+    }
+
+    __atomic_store_n(&thief->steal_response, nstolen, __ATOMIC_RELEASE);
+    __atomic_store_n(&ws->steal_request, 0, __ATOMIC_RELEASE);
 }
 
 size_t workers_backlog(hclib_worker_state *ws) {
@@ -745,13 +1317,10 @@ size_t workers_backlog(hclib_worker_state *ws) {
     hclib_worker_paths *paths = ws->paths;
     hclib_locality_path *pop = paths->pop_path;
 
-    size_t sum_work = 0;
+    size_t sum_work = ws->latent_tail - ws->latent_head;
     for (i = 0; i < pop->path_length; i++) {
         hclib_locale_t *locale = pop->locales[i];
-        hclib_internal_deque_t *deq = &(locale->deques[wid].deque);
-        const int tail = deq->tail;
-        const int head = deq->head;
-        sum_work += (tail - head);
+        sum_work += hclib_deque_size(locale->deques + wid);
     }
 
     return sum_work;
@@ -762,26 +1331,99 @@ unsigned locale_num_tasks(hclib_locale_t *locale) {
     int i;
     hclib_deque_t *deqs = locale->deques;
     for (i = 0; i < hc_context->nworkers; i++) {
-        count += deque_size(&(deqs[i].deque));
+        count += hclib_deque_size(deqs + i);
     }
     return count;
 }
 
+/*
+ * Pop from one lane of a deque owned by the current worker.
+ */
+static inline hclib_task_t *pop_lane(hclib_worker_state *ws,
+        hclib_locale_t *locale, hclib_deque_t *deq,
+        hclib_internal_deque_t *lane) {
+    if (!deq->is_private) {
+        return deque_pop(lane);
+    }
+
+    // Thieves get the oldest tasks, so answer them before popping
+    answer_steal_request(ws);
+    hclib_task_t *task = deque_pop_private(lane);
+    if (task && deque_size(lane) > 0 &&
+            atomic_load_explicit(&hc_context->idle_ec->nsleepers,
+                memory_order_relaxed) > 0) {
+        /*
+         * Thieves that gave up on us while we were busy may have gone to
+         * sleep, and pushes are the only other place that wakes them up. A
+         * relaxed check is enough, we run these tasks ourselves if nobody
+         * comes for them.
+         */
+        notify_tasks_at(locale, 1);
+    }
+    return task;
+}
+
+/*
+ * Pop the highest priority task above HCLIB_PRIORITY_DEFAULT along our pop
+ * path.
+ */
+static hclib_task_t *pop_priority_task(hclib_worker_state *ws) {
+    int i, priority;
+    hclib_locality_path *pop = ws->paths->pop_path;
+
+    for (priority = HCLIB_PRIORITY_MAX; priority > HCLIB_PRIORITY_DEFAULT;
+            priority--) {
+        for (i = 0; i < pop->path_length; i++) {
+            hclib_locale_t *locale = pop->locales[i];
+            hclib_deque_t *deq = locale->deques + ws->id;
+            hclib_internal_deque_t *lane = deque_lane(deq, priority);
+            if (deque_size(lane) == 0) continue;
+
+            hclib_task_t *task = pop_lane(ws, locale, deq, lane);
+            if (task) {
+                ws->prio_tasks--;
+                return task;
+            }
+        }
+    }
+
+    // Anything else we pushed there was stolen
+    ws->prio_tasks = 0;
+    return NULL;
+}
+
 /*
  * Try to find a new task that was originally created by this worker by
  * traversing its pop path and only looking at deques owned by this worker.
+ * Tasks with a priority are taken first, except that after
+ * HCLIB_PRIORITY_BURST of them in a row we look at the default lanes first
+ * once.
  */
 hclib_task_t *locale_pop_task(hclib_worker_state *ws) {
     int i;
     const int wid = ws->id;
     hclib_worker_paths *paths = ws->paths;
     hclib_locality_path *pop = paths->pop_path;
+    hclib_task_t *task;
 
 #ifdef VERBOSE
     fprintf(stderr, "locale_pop_task: ws=%p wid=%d pop=%p path_length=%d\n", ws,
             wid, pop, pop->path_length);
 #endif
 
+    if (ws->prio_tasks > 0 && ws->prio_streak < HCLIB_PRIORITY_BURST) {
+        if ((task = pop_priority_task(ws))) {
+            ws->prio_streak++;
+            return task;
+        }
+    }
+    ws->prio_streak = 0;
+
+    // Latent tasks are always newer than the ones in our deques
+    if (ws->latent_tasks && (task = pop_latent_task(ws))) {
+        return task;
+    }
+
     for (i = 0; i < pop->path_length; i++) {
         hclib_locale_t *locale = pop->locales[i];
 #ifdef VERBOSE
@@ -789,7 +1431,8 @@ hclib_task_t *locale_pop_task(hclib_worker_state *ws) {
                 "locale->deques=%p locale->lbl=%s\n", wid, i, locale,
                 locale->deques, locale->lbl);
 #endif
-        hclib_task_t *task = deque_pop(&(locale->deques[wid].deque));
+        hclib_deque_t *deq = locale->deques + wid;
+        task = pop_lane(ws, locale, deq, &deq->deque);
         if (task) {
 #ifdef VERBOSE
         fprintf(stderr, "locale_pop_task: wid=%d i=%d locale=%p "
@@ -801,6 +1444,10 @@ hclib_task_t *locale_pop_task(hclib_worker_state *ws) {
         }
     }
 
+    // The default lanes are empty, so a priority streak starves nothing
+    if (ws->prio_tasks > 0) {
+        return pop_priority_task(ws);
+    }
     return NULL;
 }
 
@@ -836,57 +1483,287 @@ void hclib_locale_mark_special(hclib_locale_t *locale,
     }
 }
 
+void hclib_locale_set_steal_batch(hclib_locale_t *locale, int steal_batch) {
+    assert(steal_batch >= 1 && steal_batch <= STEAL_CHUNK_SIZE);
+    locale->steal_batch = steal_batch;
+}
+
+int hclib_locale_get_steal_batch(hclib_locale_t *locale) {
+    return locale->steal_batch;
+}
+
+/*
+ * A thief keeps the oldest task it stole to run next, and pushes any others
+ * onto its own deque at the locale they were stolen from, where they can be
+ * popped by it or stolen by others.
+ */
+static inline void keep_stolen(hclib_worker_state *ws, hclib_locale_t *locale,
+        void **stolen, const int nstolen) {
+    if (nstolen > 1) {
+        deque_push_batch_locale(ws, locale, stolen + 1, nstolen - 1);
+        notify_tasks_at(locale, nstolen - 1);
+    }
+}
+
+/*
+ * Ask victim to hand us tasks from its private deque at locale, and wait for
+ * its answer. The victim only answers between tasks, so if it takes too long
+ * we withdraw the request, unless the victim has already started answering.
+ * While waiting we answer requests sent to us, so that two workers asking each
+ * other for work do not wait for each other.
+ */
+static int request_steal(hclib_worker_state *ws, hclib_locale_t *locale,
+        const int victim, void **stolen) {
+    hclib_deque_t *deq = locale->deques + victim;
+    if (victim == ws->id) {
+        return take_lanes_private(deq, stolen, locale->steal_batch);
+    }
+
+    hclib_worker_state *victim_ws = hc_context->workers[victim];
+    if (hclib_deque_size(deq) == 0 || victim_ws->steal_request != 0) {
+        return 0;
+    }
+
+    ws->steal_locale = locale;
+    ws->steal_buffer = stolen;
+    ws->steal_response = STEAL_RESPONSE_PENDING;
+    const int request = ws->id + 1;
+    if (!__sync_bool_compare_and_swap(&victim_ws->steal_request, 0,
+                request)) {
+        return 0;
+    }
+
+    int nspins = 0;
+    int nstolen;
+    while ((nstolen = __atomic_load_n(&ws->steal_response,
+                    __ATOMIC_ACQUIRE)) == STEAL_RESPONSE_PENDING) {
+        answer_steal_request(ws);
+        if (++nspins == HCLIB_STEAL_REQUEST_PATIENCE &&
+                __sync_bool_compare_and_swap(&victim_ws->steal_request,
+                    request, 0)) {
+            return 0;
+        }
+        hc_cpu_relax();
+    }
+    return nstolen;
+}
+
+static inline int try_steal_from(hclib_worker_state *ws, hclib_locale_t *locale,
+        const int victim, void **stolen) {
+    hclib_deque_t *deq = locale->deques + victim;
+    if (hc_context->workers[victim]->retired) {
+        // Handed all its tasks to others before retiring
+        return 0;
+    }
+    const int nstolen = deq->is_private ?
+        request_steal(ws, locale, victim, stolen) :
+        steal_lanes(deq, stolen, locale->steal_batch);
+    if (nstolen) {
+        ws->last_victim = victim;
+        transfer_deferred_checkins((hclib_task_t **)stolen, nstolen);
+        keep_stolen(ws, locale, stolen, nstolen);
+    } else if (locale == hc_context->graph->locales) {
+        /*
+         * Nothing to steal, but the victim may have latent tasks it would
+         * push to this locale if asked to.
+         */
+        hclib_worker_state *victim_ws = hc_context->workers[victim];
+        if (victim_ws->latent_tasks && !victim_ws->latent_wanted &&
+                __atomic_load_n(&victim_ws->latent_tail, __ATOMIC_RELAXED) !=
+                __atomic_load_n(&victim_ws->latent_head, __ATOMIC_RELAXED)) {
+            victim_ws->latent_wanted = 1;
+        }
+    }
+    return nstolen;
+}
+
 /*
  * Try to find new work by stealing work from some other worker. We traverse the
- * steal path for the current worker and check all deques at each locale.
+ * steal path for the current worker and check all deques at each locale, first
+ * the last victim we successfully stole from and then the rest in the order
+ * computed by build_victim_orders. Each tier of equally distant victims is
+ * scanned starting at a random position.
+ *
+ * Returns the number of tasks stolen. Only stolen[0] is handed back to the
+ * caller to run, the rest are already in the current worker's deques. stolen
+ * must have room for STEAL_CHUNK_SIZE tasks.
  */
 int locale_steal_task(hclib_worker_state *ws, void **stolen, int *out_victim) {
-    int i, j;
-    const int wid = ws->id;
-    const int nworkers = ws->nworkers;
+    int i, j, t;
     hclib_worker_paths *paths = ws->paths;
     hclib_locality_path *steal = paths->steal_path;
+    const int *victims = ws->steal_victims;
+    const int *tier_ends = ws->victim_tier_ends;
+    const int n_tiers = ws->n_victim_tiers;
 
 #ifdef VERBOSE
     fprintf(stderr, "locale_steal_task: ws=%p wid=%d steal=%p path_length=%d\n", ws,
-            wid, steal, steal->path_length);
+            ws->id, steal, steal->path_length);
 #endif
 
-    MARK_SEARCH(wid); // Set the state of this worker for timing
+    MARK_SEARCH(ws->id); // Set the state of this worker for timing
+
+    // Anyone asking us for work is better off asking someone else
+    answer_steal_request(ws);
 
     const int steal_path_length = steal->path_length;
     const int last_successful_locale = paths->last_successful_steal_locale;
     for (i = 0; i < steal_path_length; i++) {
         const int locale_index = (last_successful_locale + i) % steal_path_length;
         hclib_locale_t *locale = steal->locales[locale_index];
-        hclib_deque_t *deqs = locale->deques;
-
-        for (j = ws->base_intra_socket_workers; j < ws->limit_intra_socket_workers; j++) {
-            const int victim = j;
-            const int nstolen = deque_steal(&(deqs[victim].deque), stolen);
-            if (nstolen) {
-                paths->last_successful_steal_locale = locale_index;
-                *out_victim = victim;
-                return nstolen;
-            }
+        const int last_victim = ws->last_victim;
+        int nstolen;
+
+        if (last_victim >= 0 &&
+                (nstolen = try_steal_from(ws, locale, last_victim, stolen))) {
+            paths->last_successful_steal_locale = locale_index;
+            *out_victim = last_victim;
+            return nstolen;
         }
 
-        const int leftover = nworkers - (ws->limit_intra_socket_workers -
-                ws->base_intra_socket_workers);
-        for (j = 0; j < leftover; j++) {
-            const int victim = (ws->limit_intra_socket_workers + j) % nworkers;
-            const int nstolen = deque_steal(&(deqs[victim].deque), stolen);
-            if (nstolen) {
-                paths->last_successful_steal_locale = locale_index;
-                *out_victim = victim;
-                return nstolen;
+        int tier_start = 0;
+        for (t = 0; t < n_tiers; t++) {
+            const int tier_size = tier_ends[t] - tier_start;
+            const int offset = tier_size > 1 ? next_steal_rand(ws) % tier_size :
+                0;
+            for (j = 0; j < tier_size; j++) {
+                const int victim = victims[tier_start +
+                    (offset + j) % tier_size];
+                if (victim == last_victim) continue;
+
+                if ((nstolen = try_steal_from(ws, locale, victim, stolen))) {
+                    paths->last_successful_steal_locale = locale_index;
+                    *out_victim = victim;
+                    return nstolen;
+                }
             }
+            tier_start = tier_ends[t];
         }
     }
 
     return 0;
 }
 
+int path_contains(hclib_locality_path *path, hclib_locale_t *locale) {
+    int i;
+    for (i = 0; i < path->path_length; i++) {
+        if (path->locales[i] == locale) return 1;
+    }
+    return 0;
+}
+
+/*
+ * Retired workers (see hclib_set_num_active_workers) still take care of the
+ * locales on their paths that no active worker steals from, since nobody else
+ * would run the tasks there.
+ */
+static int retired_worker_keeps(hclib_worker_state *ws,
+        hclib_locale_t *locale) {
+    if (locale->n_thieves == 0) {
+        // Only ever run by the worker that pushed them
+        return 1;
+    }
+    return !locale_has_active_thief(locale) &&
+        (path_contains(ws->paths->pop_path, locale) ||
+         path_contains(ws->paths->steal_path, locale));
+}
+
+// Pop from the highest priority non-empty lane of one of our deques
+static hclib_task_t *pop_any_lane(hclib_worker_state *ws,
+        hclib_locale_t *locale) {
+    hclib_deque_t *deq = locale->deques + ws->id;
+    int priority;
+    for (priority = HCLIB_PRIORITY_MAX; priority >= HCLIB_PRIORITY_DEFAULT;
+            priority--) {
+        hclib_internal_deque_t *lane = deque_lane(deq, priority);
+        if (deque_size(lane) == 0) continue;
+
+        hclib_task_t *task = pop_lane(ws, locale, deq, lane);
+        if (task) return task;
+    }
+    return NULL;
+}
+
+/*
+ * Called by a worker that is retiring. Moves all tasks in its deques to the
+ * injected lists of their locales, except at the locales it keeps taking care
+ * of, so that the remaining workers find them without looking at this worker.
+ */
+void locale_hand_off_tasks(hclib_worker_state *ws) {
+    hclib_locality_graph *graph = hc_context->graph;
+    hclib_task_t **tasks = NULL;
+    int capacity = 0;
+    int i, j;
+
+    for (i = 0; i < graph->n_locales; i++) {
+        hclib_locale_t *locale = graph->locales + i;
+        if (hclib_deque_size(locale->deques + ws->id) == 0 ||
+                retired_worker_keeps(ws, locale)) {
+            continue;
+        }
+
+        int ntasks = 0;
+        hclib_task_t *task;
+        while ((task = pop_any_lane(ws, locale))) {
+            if (ntasks == capacity) {
+                capacity = (capacity ? 2 * capacity : 64);
+                tasks = (hclib_task_t **)realloc(tasks,
+                        capacity * sizeof(*tasks));
+                HASSERT(tasks);
+            }
+            tasks[ntasks++] = task;
+        }
+        if (ntasks == 0) continue;
+
+        transfer_deferred_checkins(tasks, ntasks);
+        // Oldest first
+        for (j = ntasks - 1; j >= 0; j--) {
+            locale_inject_task(locale, tasks[j]);
+        }
+    }
+    free(tasks);
+}
+
+/*
+ * Find a task for a retired worker at one of the locales it keeps taking care
+ * of, from its own deques, injected tasks or other workers' deques.
+ */
+hclib_task_t *locale_find_retired_task(hclib_worker_state *ws) {
+    hclib_task_t *stolen[STEAL_CHUNK_SIZE];
+    hclib_locality_path *pop = ws->paths->pop_path;
+    hclib_locality_path *steal = ws->paths->steal_path;
+    hclib_task_t *task = NULL;
+    int i, victim;
+
+    for (i = 0; i < pop->path_length; i++) {
+        hclib_locale_t *locale = pop->locales[i];
+        if (retired_worker_keeps(ws, locale) &&
+                (task = pop_any_lane(ws, locale))) {
+            return task;
+        }
+    }
+
+    for (i = 0; i < steal->path_length; i++) {
+        hclib_locale_t *locale = steal->locales[i];
+        if (!retired_worker_keeps(ws, locale)) continue;
+
+        if (locale->injected != NULL) {
+            drain_injected_at(ws, locale, &task);
+            if (task) return task;
+        }
+        if ((task = pop_any_lane(ws, locale))) {
+            return task;
+        }
+        for (victim = 0; victim < hc_context->nworkers; victim++) {
+            if (victim != ws->id &&
+                    try_steal_from(ws, locale, victim, (void **)stolen)) {
+                return stolen[0];
+            }
+        }
+    }
+    return NULL;
+}
+
 /*
  * Count the number of locales present in the platform.
  */
@@ -1051,13 +1928,13 @@ static int keep_duplicates(hclib_locale_t **l, hclib_locale_t **path,
 }
 
 /*
- * Fetch a locale that is on all threads' pop and steal paths.
+ * Fetch a locale that is on the pop and steal paths of all threads outside of
+ * arenas.
  */
 hclib_locale_t *hclib_get_central_place() {
-    static int central_initialized = 0;
-    static hclib_locale_t *central = NULL;
+    hclib_locale_t *central = hc_context->central_place;
 
-    if (central_initialized == 0) {
+    if (central == NULL) {
         hclib_worker_paths *paths = hc_context->worker_paths + 0;
         hclib_locality_path *steal = paths->steal_path;
         hclib_locality_path *pop = paths->pop_path;
@@ -1073,6 +1950,7 @@ hclib_locale_t *hclib_get_central_place() {
         int worker;
         for (worker = 1; worker < hc_context->nworkers; worker++) {
             paths = hc_context->worker_paths + worker;
+            if (paths->arena) continue;
             steal = paths->steal_path;
             pop = paths->pop_path;
 
@@ -1086,12 +1964,28 @@ hclib_locale_t *hclib_get_central_place() {
             central = candidates[0];
         }
         free(candidates);
-        central_initialized = 1;
+        hc_context->central_place = central;
     }
 
     return central;
 }
 
+/*
+ * Fetch the locale of the arena with the given name, or NULL if there is none.
+ */
+hclib_locale_t *hclib_get_arena(const char *name) {
+    hclib_locality_graph *graph = hc_context->graph;
+    int i;
+    for (i = 0; i < graph->n_locales; i++) {
+        hclib_locale_t *locale = graph->locales + i;
+        if (locale->is_arena &&
+                strcmp(locale->lbl + strlen(ARENA_LBL_PREFIX), name) == 0) {
+            return locale;
+        }
+    }
+    return NULL;
+}
+
 /*
  * Return a list of all the locales in the current runtime. The length of this
  * list can be determined by hclib_get_num_locales.
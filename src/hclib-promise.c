@@ -37,9 +37,14 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
 #include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
 
 #include "hclib-internal.h"
 #include "hclib-task.h"
+#include "hclib-async-struct.h"
+
+extern hclib_context *hc_context;
 
 // Control debug statements
 #define DEBUG_PROMISE 0
@@ -47,8 +52,63 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 // Index value indicating that all dependencies are ready
 #define FUTURE_FRONTIER_EMPTY (-1)
 
+// Max number of tasks a put releases before handing them to the scheduler
+#define RELEASE_BATCH_SIZE 64
+
+/*
+ * In dependency counting mode (see HCLIB_DEPENDENCY_COUNTING) a task awaiting
+ * several futures is registered on all of them at once, through one
+ * dependency_t each rather than through its own next_waiter. They share a
+ * dependency_set_t counting the futures not satisfied yet, and whichever put
+ * brings it to zero releases the task.
+ *
+ * The same goes for the futures combined by hclib_when_all and hclib_when_any,
+ * whose sets have no task and are part of a combinator_t.
+ */
+typedef struct _dependency_set_t {
+    hclib_task_t *task;
+    volatile int pending;
+} dependency_set_t;
+
+typedef struct _dependency_t {
+    hclib_task_t *next_waiter;
+    dependency_set_t *set;
+} dependency_t;
+
+/*
+ * The shared promise of hclib_when_all or hclib_when_any, followed in memory by
+ * one dependency_t per future it combines. The futures hold one reference on
+ * the promise until they have all been satisfied, since their puts still walk
+ * into the dependencies.
+ */
+typedef struct _combinator_t {
+    hclib_promise_t promise;
+    dependency_set_t set;
+    // Whether any one future satisfies the promise, rather than all of them
+    int any;
+    // For hclib_when_any, whether a future already satisfied the promise
+    volatile int fired;
+} combinator_t;
+
+/*
+ * Dependencies are kept in the same wait lists as tasks, told apart by their
+ * lowest address bit.
+ */
+#define DEPENDENCY_TAG ((uintptr_t)0x1)
+
+static inline int _is_dependency(hclib_task_t *waiter) {
+    return ((uintptr_t)waiter & DEPENDENCY_TAG) != 0;
+}
+
+static inline dependency_t *_untag_dependency(hclib_task_t *waiter) {
+    return (dependency_t *)((uintptr_t)waiter & ~DEPENDENCY_TAG);
+}
+
 static inline hclib_task_t **_next_waiting_task(hclib_task_t *t) {
     HASSERT(t);
+    if (_is_dependency(t)) {
+        return &_untag_dependency(t)->next_waiter;
+    }
     return &t->next_waiter;
 }
 
@@ -57,8 +117,10 @@ static inline hclib_task_t **_next_waiting_task(hclib_task_t *t) {
  */
 void hclib_promise_init(hclib_promise_t *promise) {
     promise->satisfied = 0;
+    promise->nrefs = 0;
     promise->datum = UNINITIALIZED_PROMISE_DATA_PTR;
     promise->wait_list_head = SENTINEL_FUTURE_WAITLIST_PTR;
+    promise->producer = NULL;
     promise->future.owner = promise;
 }
 
@@ -72,6 +134,35 @@ hclib_promise_t *hclib_promise_create() {
     return promise;
 }
 
+void hclib_promise_init_shared(hclib_promise_t *promise, int nrefs) {
+    HASSERT(nrefs > 0);
+    hclib_promise_init(promise);
+    promise->nrefs = nrefs;
+}
+
+/**
+ * Allocate a reference counted promise from the object slabs.
+ */
+hclib_promise_t *hclib_promise_create_shared(int nrefs) {
+    hclib_promise_t *promise = (hclib_promise_t *)hclib_object_alloc(
+            sizeof(hclib_promise_t));
+    hclib_promise_init_shared(promise, nrefs);
+    return promise;
+}
+
+void hclib_future_retain(hclib_future_t *future) {
+    HASSERT(future->owner->nrefs > 0 && "not a shared promise");
+    __sync_fetch_and_add(&future->owner->nrefs, 1);
+}
+
+void hclib_future_release(hclib_future_t *future) {
+    hclib_promise_t *promise = future->owner;
+    HASSERT(promise->nrefs > 0 && "not a shared promise");
+    if (__sync_sub_and_fetch(&promise->nrefs, 1) == 0) {
+        hclib_object_free(promise);
+    }
+}
+
 hclib_future_t *hclib_get_future_for_promise(hclib_promise_t *promise) {
     return &promise->future;
 }
@@ -165,10 +256,89 @@ static inline int _register_if_promise_not_ready(
     return success;
 }
 
+static inline hclib_future_t *_get_dependency(hclib_task_t *task, int i) {
+    if (i < MAX_NUM_WAITS) {
+        return task->waiting_on[i];
+    }
+#ifndef HCLIB_INLINE_FUTURES_ONLY
+    if (task->waiting_on_extra) {
+        return task->waiting_on_extra[i - MAX_NUM_WAITS];
+    }
+#endif
+    return NULL;
+}
+
+/*
+ * Register dep on future as part of set. Returns '1' if the task was
+ * registered and is now waiting, as _register_if_promise_not_ready.
+ */
+static inline int _register_dependency(dependency_t *dep,
+        dependency_set_t *set, hclib_future_t *future) {
+    dep->set = set;
+    return _register_if_promise_not_ready(
+            (hclib_task_t *)((uintptr_t)dep | DEPENDENCY_TAG), future);
+}
+
+/*
+ * Drop one of the futures counted by set. Returns the task if that was the
+ * last, in which case set is released.
+ */
+static inline hclib_task_t *_release_dependency(dependency_set_t *set,
+        int count) {
+    if (__sync_sub_and_fetch(&set->pending, count) == 0) {
+        hclib_task_t *task = set->task;
+        hclib_object_free(set);
+        return task;
+    }
+    return NULL;
+}
+
+/**
+ * Register wrapper_task on all of its futures at once, see dependency_set_t.
+ * Returns '1' if they have all been satisfied already.
+ */
+static int register_on_all_promise_dependencies_counted(
+        hclib_task_t *wrapper_task, int nfutures) {
+    dependency_set_t *set = (dependency_set_t *)hclib_object_alloc(
+            sizeof(*set) + nfutures * sizeof(dependency_t));
+    dependency_t *deps = (dependency_t *)(set + 1);
+    set->task = wrapper_task;
+    /*
+     * One extra count for ourselves, so that puts can not release the task
+     * while we are still registering it.
+     */
+    set->pending = nfutures + 1;
+
+    int satisfied = 1;
+    int i;
+    for (i = 0; i < nfutures; i++) {
+        if (!_register_dependency(deps + i, set,
+                    _get_dependency(wrapper_task, i))) {
+            satisfied++;
+        }
+    }
+
+    return _release_dependency(set, satisfied) != NULL;
+}
+
 /**
  * Returns '1' if all promise dependencies have been satisfied.
  */
 int register_on_all_promise_dependencies(hclib_task_t *wrapper_task) {
+    /*
+     * Counting only pays off from two futures on. It is chosen on the first
+     * call, when the task is spawned.
+     */
+    if (wrapper_task->waiting_on_index == -1 && wrapper_task->waiting_on[1] &&
+            hc_context && hc_context->dependency_counting) {
+        int nfutures = 2;
+        while (_get_dependency(wrapper_task, nfutures)) {
+            nfutures++;
+        }
+        return register_on_all_promise_dependencies_counted(wrapper_task,
+                nfutures);
+    }
+
     while (wrapper_task->waiting_on_index < MAX_NUM_WAITS - 1) {
         wrapper_task->waiting_on_index++;
         hclib_future_t *curr = wrapper_task->waiting_on[wrapper_task->waiting_on_index];
@@ -194,6 +364,92 @@ int register_on_all_promise_dependencies(hclib_task_t *wrapper_task) {
     return 1;
 }
 
+/*
+ * Drop count of the futures combined by c, and release c once they have all
+ * been satisfied.
+ */
+static void _release_combinator(combinator_t *c, int count) {
+    if (__sync_sub_and_fetch(&c->set.pending, count) == 0) {
+        if (!c->any) {
+            hclib_promise_put(&c->promise, NULL);
+        }
+        hclib_future_release(&c->promise.future);
+    }
+}
+
+// Called when satisfied_by, one of the futures combined by c, is put on
+static void _combinator_input_satisfied(combinator_t *c,
+        hclib_promise_t *satisfied_by) {
+    if (c->any && __sync_bool_compare_and_swap(&c->fired, 0, 1)) {
+        hclib_promise_put(&c->promise, &satisfied_by->future);
+    }
+    _release_combinator(c, 1);
+}
+
+static hclib_future_t *_when(hclib_future_t **futures, int nfutures,
+        int any) {
+    int i;
+
+    /*
+     * If the outcome is already known, only the resulting promise is needed
+     * and we do not register on anything.
+     */
+    for (i = 0; i < nfutures; i++) {
+        const int satisfied = _hclib_promise_is_satisfied(futures[i]->owner);
+        if (any && satisfied) {
+            hclib_promise_t *result = hclib_promise_create_shared(1);
+            hclib_promise_put(result, futures[i]);
+            return &result->future;
+        } else if (!any && !satisfied) {
+            break;
+        }
+    }
+    if (!any && i == nfutures) {
+        hclib_promise_t *result = hclib_promise_create_shared(1);
+        hclib_promise_put(result, NULL);
+        return &result->future;
+    }
+
+    combinator_t *c = (combinator_t *)hclib_object_alloc(sizeof(*c) +
+            nfutures * sizeof(dependency_t));
+    dependency_t *deps = (dependency_t *)(c + 1);
+    // One reference for the caller, one for the futures
+    hclib_promise_init_shared(&c->promise, 2);
+    c->set.task = NULL;
+    // As in register_on_all_promise_dependencies_counted
+    c->set.pending = nfutures + 1;
+    c->any = any;
+    c->fired = 0;
+
+    int satisfied = 1;
+    for (i = 0; i < nfutures; i++) {
+        if (!_register_dependency(deps + i, &c->set, futures[i])) {
+            satisfied++;
+            if (any) {
+                // No need to register on the others
+                if (__sync_bool_compare_and_swap(&c->fired, 0, 1)) {
+                    hclib_promise_put(&c->promise, futures[i]);
+                }
+                satisfied += nfutures - i - 1;
+                break;
+            }
+        }
+    }
+
+    hclib_future_t *result = &c->promise.future;
+    _release_combinator(c, satisfied);
+    return result;
+}
+
+hclib_future_t *hclib_when_all(hclib_future_t **futures, int nfutures) {
+    return _when(futures, nfutures, 0);
+}
+
+hclib_future_t *hclib_when_any(hclib_future_t **futures, int nfutures) {
+    HASSERT(nfutures > 0);
+    return _when(futures, nfutures, 1);
+}
+
 /**
  * Put datum in the promise.
  * Close down registration of triggered tasks on this promise and iterate over
@@ -224,24 +480,56 @@ void hclib_promise_put(hclib_promise_t *promise_to_be_put,
         wait_list_of_promise = promise_to_be_put->wait_list_head;
     }
 
+    /*
+     * Tasks that become ready are scheduled in batches, so that a put releasing
+     * many of them publishes them with few deque operations.
+     */
     hclib_worker_state *ws = CURRENT_WS_INTERNAL;
+    hclib_task_t *released[RELEASE_BATCH_SIZE];
+    int nreleased = 0;
     hclib_task_t *curr_task = wait_list_of_promise;
     hclib_task_t *next_task = NULL;
     while (curr_task != SENTINEL_FUTURE_WAITLIST_PTR) {
 
         next_task = *_next_waiting_task(curr_task);
-        /*
-         * For each task that was registered on this promise, we register on the
-         * next promise in its list. If there are no remaining unsatisfied
-         * promises in its list, the dependent task is made eligible for
-         * scheduling.
-         */
-        if (register_on_all_promise_dependencies(curr_task)) {
-            try_schedule_async(curr_task, ws);
+        hclib_task_t *ready = NULL;
+        if (_is_dependency(curr_task)) {
+            dependency_set_t *set = _untag_dependency(curr_task)->set;
+            if (set->task) {
+                // The task is released with its last unsatisfied future
+                ready = _release_dependency(set, 1);
+            } else {
+                _combinator_input_satisfied((combinator_t *)((char *)set -
+                            offsetof(combinator_t, set)), promise_to_be_put);
+            }
+        } else if (register_on_all_promise_dependencies(curr_task)) {
+            /*
+             * For each task that was registered on this promise, we register on
+             * the next promise in its list. If there are no remaining
+             * unsatisfied promises in its list, the dependent task is made
+             * eligible for scheduling.
+             */
+            ready = curr_task;
+        }
+
+        if (ready) {
+            released[nreleased++] = ready;
+            if (nreleased == RELEASE_BATCH_SIZE) {
+                schedule_released_tasks(released, nreleased, ws);
+                nreleased = 0;
+            }
         }
 
         curr_task = next_task;
     }
+    if (nreleased) {
+        schedule_released_tasks(released, nreleased, ws);
+    }
+
+    // Wake up anyone sleeping in hclib_future_wait on this promise
+    if (hc_context) {
+        hclib_ec_notify_flag(hc_context->idle_ec);
+    }
 }
 
 
@@ -54,6 +54,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <hclib-locality-graph.h>
 #include <hclib-module.h>
 #include <hclib-instrument.h>
+#include <hclib-async-struct.h>
 
 #ifdef HAVE_DLFCN_H
 #include <dlfcn.h>
@@ -69,8 +70,8 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #endif
 
 static double user_specified_timer = 0;
-// TODO use __thread on Linux?
-pthread_key_t ws_key;
+__thread hclib_worker_state *_hclib_curr_ws
+    __attribute__((tls_model("initial-exec"))) = NULL;
 
 hclib_context *hc_context = NULL;
 
@@ -97,8 +98,19 @@ typedef struct _per_worker_stats {
     size_t count_future_waits;
     size_t count_end_finishes_nonblocking;
     size_t count_ctx_creates;
+    size_t count_ctx_allocs;
     size_t count_yields;
     size_t count_yield_iterations;
+    // Number of times this worker went to sleep for lack of work
+    size_t count_parks;
+    // Number of latent tasks this worker made visible to thieves
+    size_t promoted_tasks;
+    // Number of tasks this worker ran as soon as they were spawned
+    size_t work_first_spawns;
+    // Number of producers this worker ran inline while waiting on a future
+    size_t inline_producers;
+    // Number of times this worker retired
+    size_t count_retires;
 } per_worker_stats;
 static per_worker_stats *worker_stats = NULL;
 #endif
@@ -149,10 +161,7 @@ unsigned long long hclib_current_time_ms() {
 }
 
 static void set_current_worker(int wid) {
-    int err;
-    if ((err = pthread_setspecific(ws_key, hc_context->workers[wid])) != 0) {
-        log_die("Cannot set thread-local worker state");
-    }
+    _hclib_curr_ws = hc_context->workers[wid];
 
     /*
      * don't bother worrying about core affinity on Mac OS since no one will be
@@ -193,13 +202,13 @@ static void set_current_worker(int wid) {
 }
 
 int hclib_get_current_worker() {
-    hclib_worker_state *ws = (hclib_worker_state *)pthread_getspecific(ws_key);
+    hclib_worker_state *ws = CURRENT_WS_INTERNAL;
     assert(ws);
     return ws->id;
 }
 
 unsigned hclib_get_current_worker_pending_work() {
-    return ((hclib_worker_state *)pthread_getspecific(ws_key))->id;
+    return CURRENT_WS_INTERNAL->id;
 }
 
 static void set_curr_lite_ctx(LiteCtx *ctx) {
@@ -210,6 +219,53 @@ static LiteCtx *get_curr_lite_ctx() {
     return CURRENT_WS_INTERNAL->curr_ctx;
 }
 
+/*
+ * Get a context from the current worker's pool, or map a new one if the pool
+ * is empty, and set it up to start executing fn.
+ */
+static LiteCtx *ctx_create(void (*fn)(LiteCtx *)) {
+    hclib_worker_state *ws = CURRENT_WS_INTERNAL;
+    LiteCtx *ctx = ws->ctx_pool;
+    if (ctx) {
+        ws->ctx_pool = ctx->pool_next;
+        ws->ctx_pool_size--;
+    } else {
+        // Racy, but the bound does not need to be exact
+        ctx = LiteCtx_alloc(hc_context->ctx_stack_size,
+                hc_context->guarded_ctxs < HCLIB_MAX_GUARDED_CTXS);
+        if (ctx->_guarded) {
+            __sync_fetch_and_add(&hc_context->guarded_ctxs, 1);
+        }
+#ifdef HCLIB_STATS
+        worker_stats[ws->id].count_ctx_allocs++;
+#endif
+    }
+    LiteCtx_init(ctx, fn);
+    return ctx;
+}
+
+static void ctx_free(LiteCtx *ctx) {
+    if (ctx->_guarded) {
+        __sync_fetch_and_sub(&hc_context->guarded_ctxs, 1);
+    }
+    LiteCtx_destroy(ctx);
+}
+
+/*
+ * Return a defunct context to the current worker's pool. Its stack pages stay
+ * mapped and faulted in, which is what makes reusing it cheap.
+ */
+static void ctx_destroy(LiteCtx *ctx) {
+    hclib_worker_state *ws = CURRENT_WS_INTERNAL;
+    if (ws->ctx_pool_size < hc_context->ctx_pool_max) {
+        ctx->pool_next = ws->ctx_pool;
+        ws->ctx_pool = ctx;
+        ws->ctx_pool_size++;
+    } else {
+        ctx_free(ctx);
+    }
+}
+
 static __inline__ void ctx_swap(LiteCtx *current, LiteCtx *next,
                                 const char *lbl) {
     // switching to new context
@@ -221,21 +277,21 @@ static __inline__ void ctx_swap(LiteCtx *current, LiteCtx *next,
     set_curr_lite_ctx(current);
 }
 
-hclib_worker_state *current_ws() {
-    return CURRENT_WS_INTERNAL;
+__attribute__((noinline)) hclib_worker_state *current_ws() {
+    return _hclib_curr_ws;
 }
 
 // FWD declaration for pthread_create
 static void *worker_routine(void *args);
+static void _finish_ctx_resume(void *arg);
+static void core_work_loop(hclib_task_t *starting_task);
 
 hclib_locale_t *default_dist_func(const int dim,
         const hclib_loop_domain_t *subloops, const hclib_loop_domain_t *loops,
         const int mode) {
-    static hclib_locale_t *central_place = NULL;
-    if (!central_place) {
-        central_place = hclib_get_central_place();
-    }
-    return central_place;
+    // Loops in an arena stay there
+    hclib_locale_t *arena = CURRENT_WS_INTERNAL->paths->arena;
+    return arena ? arena : hclib_get_central_place();
 }
 
 /*
@@ -272,9 +328,122 @@ void hclib_global_init() {
     hc_context->nworkers = nworkers;
     hc_context->graph = graph;
     hc_context->worker_paths = worker_paths;
+    hc_context->central_place = NULL;
     const int perr = posix_memalign((void **)&hc_context->done_flags, 64,
             nworkers * sizeof(worker_done_t));
     HASSERT(perr == 0);
+    hc_context->task_slabs = hclib_task_slabs_create(nworkers);
+    hc_context->object_slabs = hclib_task_slabs_create(nworkers);
+
+    hc_context->ctx_stack_size = LITECTX_SIZE;
+    const char *stack_size_str = getenv("HCLIB_STACK_SIZE");
+    if (stack_size_str) {
+        char *end;
+        unsigned long stack_size = strtoul(stack_size_str, &end, 10);
+        if (*end == 'k' || *end == 'K') {
+            stack_size <<= 10;
+            end++;
+        } else if (*end == 'm' || *end == 'M') {
+            stack_size <<= 20;
+            end++;
+        }
+        if (*end != '\0' || stack_size < 4 * sizeof(LiteCtx)) {
+            fprintf(stderr, "Invalid HCLIB_STACK_SIZE \"%s\", expected a "
+                    "number of bytes optionally followed by K or M\n",
+                    stack_size_str);
+            exit(1);
+        }
+        hc_context->ctx_stack_size = stack_size;
+    }
+
+    const int ec_err = posix_memalign((void **)&hc_context->idle_ec, 64,
+            sizeof(hclib_eventcount_t));
+    HASSERT(ec_err == 0);
+    hclib_ec_init(hc_context->idle_ec);
+    hc_context->spin_before_park = HCLIB_DEFAULT_SPIN_BEFORE_PARK;
+    const char *spin_str = getenv("HCLIB_SPIN_BEFORE_PARK");
+    if (spin_str) {
+        hc_context->spin_before_park = atoi(spin_str);
+    }
+
+    /*
+     * In private deque mode deque operations by their owner need no atomics,
+     * at the cost of slower steals: thieves have to ask the owner for tasks
+     * and wait for it to reach a spawn or look for its next task.
+     */
+    const char *private_deques_str = getenv("HCLIB_PRIVATE_DEQUES");
+    hc_context->private_deques = (private_deques_str &&
+            atoi(private_deques_str) != 0);
+    if (hc_context->private_deques) {
+        mark_private_deques(worker_paths, nworkers);
+    }
+
+    /*
+     * In heartbeat mode spawned tasks stay latent on their worker, and are
+     * only made visible to thieves at most once every HCLIB_HEARTBEAT_US
+     * microseconds, or when a thief asks for them.
+     */
+    hc_context->heartbeat_ns = 0;
+    const char *heartbeat_str = getenv("HCLIB_HEARTBEAT_US");
+    if (heartbeat_str) {
+        char *end;
+        const unsigned long heartbeat_us = strtoul(heartbeat_str, &end, 10);
+        if (*end != '\0') {
+            fprintf(stderr, "Invalid HCLIB_HEARTBEAT_US \"%s\", expected a "
+                    "number of microseconds\n", heartbeat_str);
+            exit(1);
+        }
+        hc_context->heartbeat_ns = heartbeat_us * 1000ULL;
+    }
+
+    /*
+     * In work-first mode a task that spawns another is suspended so that the
+     * child runs immediately, and the rest of the parent becomes a task that
+     * thieves can take. Recursive programs then run in the same depth-first
+     * order as their sequential version.
+     */
+    const char *work_first_str = getenv("HCLIB_WORK_FIRST");
+    hc_context->work_first = (work_first_str && atoi(work_first_str) != 0);
+    hc_context->ctx_pool_max = HCLIB_CTX_POOL_SIZE;
+    hc_context->guarded_ctxs = 0;
+    if (hc_context->work_first &&
+            hc_context->ctx_pool_max < HCLIB_WORK_FIRST_MAX_DEPTH) {
+        hc_context->ctx_pool_max = HCLIB_WORK_FIRST_MAX_DEPTH;
+    }
+
+    /*
+     * With HCLIB_DEPENDENCY_COUNTING=1, a task awaiting several futures is
+     * registered on all of them when it is spawned, and the put that
+     * satisfies the last one releases it. Otherwise it is registered on one
+     * future at a time, and each put moves it on to the next unsatisfied one.
+     */
+    const char *dep_counting_str = getenv("HCLIB_DEPENDENCY_COUNTING");
+    hc_context->dependency_counting = (dep_counting_str &&
+            atoi(dep_counting_str) != 0);
+
+    /*
+     * With HCLIB_ELASTIC_IDLE_US set, workers that go without work for that
+     * many microseconds retire, and are reactivated when tasks pile up.
+     */
+    hc_context->nactive = nworkers;
+    hc_context->max_active = nworkers;
+    hc_context->elastic_idle_ns = 0;
+    const char *elastic_str = getenv("HCLIB_ELASTIC_IDLE_US");
+    if (elastic_str) {
+        char *end;
+        const unsigned long idle_us = strtoul(elastic_str, &end, 10);
+        if (*end != '\0') {
+            fprintf(stderr, "Invalid HCLIB_ELASTIC_IDLE_US \"%s\", expected a "
+                    "number of microseconds\n", elastic_str);
+            exit(1);
+        }
+        hc_context->elastic_idle_ns = idle_us * 1000ULL;
+    }
+    const int rec_err = posix_memalign((void **)&hc_context->retired_ec, 64,
+            sizeof(hclib_eventcount_t));
+    HASSERT(rec_err == 0);
+    hclib_ec_init(hc_context->retired_ec);
+
     hc_context->workers = (hclib_worker_state **)calloc(nworkers,
             sizeof(*(hc_context->workers)));
     assert(hc_context->workers);
@@ -286,6 +455,11 @@ void hclib_global_init() {
         ws->id = i;
         ws->nworkers = hc_context->nworkers;
         ws->paths = worker_paths + i;
+        if (hc_context->heartbeat_ns) {
+            ws->latent_tasks = (hclib_task_t **)malloc(HCLIB_LATENT_TASKS *
+                    sizeof(*(ws->latent_tasks)));
+            assert(ws->latent_tasks);
+        }
         hc_context->done_flags[i].flag = 1;
         hc_context->workers[i] = ws;
     }
@@ -349,11 +523,6 @@ static void hclib_entrypoint(const char **module_dependencies,
         initialize_instrumentation(hc_context->nworkers);
     }
 
-    /* Create key to store per thread worker_state */
-    if (pthread_key_create(&ws_key, NULL) != 0) {
-        log_die("Cannot create ws_key for worker-specific data");
-    }
-
     /*
      * set pthread's concurrency. Doesn't seem to do much on Linux, only
      * relevant when there are more pthreads than hardware cores to schedule
@@ -379,6 +548,8 @@ static void hclib_entrypoint(const char **module_dependencies,
     }
 
     create_hwloc_cpusets();
+    build_victim_orders(hc_context->workers, hc_context->nworkers,
+            hc_context->graph);
 
     // Start workers
     for (int i = 1; i < hc_context->nworkers; i++) {
@@ -398,6 +569,7 @@ static void hclib_entrypoint(const char **module_dependencies,
 
     // allocate root finish
     hclib_start_finish();
+    hc_context->root_finish = CURRENT_WS_INTERNAL->current_finish;
 }
 
 void hclib_signal_join(int nb_workers) {
@@ -405,6 +577,9 @@ void hclib_signal_join(int nb_workers) {
     for (i = 0; i < nb_workers; i++) {
         hc_context->done_flags[i].flag = 0;
     }
+    hc_mfence();
+    hclib_ec_wake(hc_context->idle_ec, -1);
+    hclib_ec_wake(hc_context->retired_ec, -1);
 }
 
 void hclib_join(int nb_workers) {
@@ -420,12 +595,53 @@ void hclib_join(int nb_workers) {
 #endif
 }
 
+/*
+ * Release everything hclib_entrypoint set up, so that the runtime can be
+ * initialized again later in the same process.
+ */
 void hclib_cleanup() {
-    pthread_key_delete(ws_key);
-
     hclib_call_finalize_functions();
+    hclib_free_per_worker_module_state();
+
+    for (int i = 0; i < hc_context->nworkers; i++) {
+        hclib_worker_state *ws = hc_context->workers[i];
+        while (ws->ctx_pool) {
+            LiteCtx *ctx = ws->ctx_pool;
+            ws->ctx_pool = ctx->pool_next;
+            ctx_free(ctx);
+        }
+        ws->ctx_pool_size = 0;
 
+        while (ws->finish_pool) {
+            finish_t *finish = ws->finish_pool;
+            ws->finish_pool = finish->pool_next;
+            free(finish);
+        }
+        ws->finish_pool_size = 0;
+
+        free(ws->latent_tasks);
+        ws->latent_tasks = NULL;
+    }
+
+    free_victim_orders(hc_context->workers, hc_context->nworkers);
+    hclib_task_slabs_destroy(hc_context->task_slabs, hc_context->nworkers);
+    hclib_task_slabs_destroy(hc_context->object_slabs, hc_context->nworkers);
+    hclib_ec_destroy(hc_context->idle_ec);
+    free(hc_context->idle_ec);
+    hclib_ec_destroy(hc_context->retired_ec);
+    free(hc_context->retired_ec);
+
+    for (int i = 0; i < hc_context->nworkers; i++) {
+        free(hc_context->workers[i]);
+    }
+    free(hc_context->workers);
+    free(hc_context->done_flags);
+    free_locality_info(hc_context->graph, hc_context->worker_paths,
+            hc_context->nworkers);
+    hclib_release_dist_funcs();
     free(hc_context);
+    hc_context = NULL;
+    _hclib_curr_ws = NULL;
 }
 
 static inline void check_in_finish(finish_t *finish) {
@@ -440,20 +656,187 @@ static inline void check_out_finish(finish_t *finish) {
         const int old = hc_atomic_dec(&(finish->counter));
         if (old == 1) {
             // If old was 1 and we decremented to 0
-            hclib_promise_put(finish->finish_dep->owner, finish);
+            hclib_promise_t *dep = finish->finish_dep->owner;
+            const int shared = (dep->nrefs != 0);
+            hclib_promise_put(dep, finish);
+            if (shared) {
+                // Drop the reference held for this put, see nonblocking_finish
+                hclib_future_release(&dep->future);
+            }
+        } else if (old == 2) {
+            // Only the task at the end finish is left, it may be asleep
+            hclib_ec_notify_flag(hc_context->idle_ec);
+        }
+    }
+}
+
+/*
+ * Every task in a finish scope is checked in on the finish counter when it is
+ * spawned and checked out when it completes. With many workers running tasks
+ * from the same finish (e.g. a large forasync) that counter becomes a hot
+ * cache line, so instead a worker defers the check-ins of the tasks it spawns
+ * into one finish at a time (ws->deferred_finish), and holds a single
+ * reference on the counter on their behalf.
+ *
+ * While such a task stays on the worker that spawned it, it completes without
+ * touching the counter at all. If it leaves that worker, because it was stolen
+ * or because it was suspended and may be resumed elsewhere, it is checked in
+ * at that point and behaves like any other task from then on. Once all of the
+ * tasks it deferred are accounted for one way or the other, at a steal
+ * boundary, the worker drops its reference.
+ */
+static inline int release_deferred_finish(hclib_worker_state *ws) {
+    finish_t *finish = ws->deferred_finish;
+    if (ws->deferred_spawned != ws->deferred_completed +
+            (unsigned)ws->deferred_transferred) {
+        // Some are still queued, running, or in the middle of being stolen
+        return 0;
+    }
+
+    // Nobody else will touch deferred_transferred until we defer again
+    ws->deferred_transferred = 0;
+    ws->deferred_spawned = 0;
+    ws->deferred_completed = 0;
+    ws->deferred_finish = NULL;
+    check_out_finish(finish);
+    return 1;
+}
+
+static inline void check_in_task(hclib_worker_state *ws, hclib_task_t *task) {
+    finish_t *finish = ws->current_finish;
+    set_current_finish(task, finish);
+    task->deferred_checkin = 0;
+    if (finish == NULL) return;
+
+    if (ws->deferred_finish != finish) {
+        if (ws->deferred_finish && !release_deferred_finish(ws)) {
+            // Still holding on to another finish, check in the usual way
+            check_in_finish(finish);
+            return;
+        }
+        // Take the reference that covers the tasks we are about to defer
+        check_in_finish(finish);
+        ws->deferred_finish = finish;
+    }
+    ws->deferred_spawned++;
+    task->deferred_checkin = ws->id + 1;
+}
+
+static inline void check_out_task(hclib_task_t *task, finish_t *finish) {
+    if (task->deferred_checkin) {
+        hclib_worker_state *ws = CURRENT_WS_INTERNAL;
+        HASSERT(task->deferred_checkin == ws->id + 1);
+        HASSERT(ws->deferred_finish == finish);
+        ws->deferred_completed++;
+    } else {
+        check_out_finish(finish);
+    }
+}
+
+/*
+ * Check in tasks whose check-in was deferred by the worker that spawned them,
+ * which are about to run somewhere other than on that worker. Must be called
+ * before the tasks become visible to any other worker.
+ */
+void transfer_deferred_checkins(hclib_task_t **tasks, int ntasks) {
+    int i;
+    int wake = 0;
+    for (i = 0; i < ntasks; i++) {
+        hclib_task_t *task = tasks[i];
+        const int spawner = task->deferred_checkin - 1;
+        if (spawner < 0) continue;
+
+        check_in_finish(task->current_finish);
+        task->deferred_checkin = 0;
+        // Only after the check-in, so the spawner never drops its reference early
+        hclib_worker_state *spawner_ws = hc_context->workers[spawner];
+        hc_atomic_inc(&(spawner_ws->deferred_transferred));
+        wake = wake || spawner_ws != CURRENT_WS_INTERNAL;
+    }
+
+    if (wake) {
+        /*
+         * The spawner may have gone to sleep waiting for this transfer before
+         * it could drop its reference on the finish.
+         */
+        hclib_ec_notify(hc_context->idle_ec, -1);
+    }
+}
+
+/*
+ * The current task is about to be suspended, after which it may be resumed on
+ * a different worker. So may the tasks it was run inline on top of.
+ */
+static inline void transfer_suspended_task(hclib_task_t *task) {
+    for (; task; task = task->inline_parent) {
+        if (task->deferred_checkin) {
+            transfer_deferred_checkins(&task, 1);
+        }
+    }
+}
+
+/*
+ * A task linked to the promise it satisfies (see hclib_task_set_producer) is
+ * run by whoever claims it first: the worker that takes it from a deque, or a
+ * task waiting on that promise. Returns 0 if somebody else did.
+ */
+static inline int claim_producer(hclib_worker_state *ws, hclib_task_t *task) {
+    while (1) {
+        const int claim = task->producer_claim;
+        if (claim == 0) {
+            if (__sync_bool_compare_and_swap(&task->producer_claim, 0,
+                        ws->id + 1)) {
+                // Waiters can no longer run it, so stop advertising it
+                task->produces->producer = NULL;
+                return 1;
+            }
+        } else if (claim == PRODUCER_CLAIM_TENTATIVE) {
+            hc_cpu_relax();
+        } else {
+            return 0;
+        }
+    }
+}
+
+/*
+ * Release the tasks among tasks, just taken from one of our own deques, that
+ * already ran inline in a waiter, as execute_task would. Compacts the others
+ * at the start of tasks and returns how many there are.
+ */
+int release_ran_inline(hclib_task_t **tasks, int ntasks) {
+    int i, nkept = 0;
+    for (i = 0; i < ntasks; i++) {
+        hclib_task_t *task = tasks[i];
+        if (task->produces && task->producer_claim > 0) {
+            check_out_task(task, task->current_finish);
+            hclib_task_free(task);
+        } else {
+            tasks[nkept++] = task;
         }
     }
+    return nkept;
 }
 
 static inline void execute_task(hclib_task_t *task) {
     finish_t *current_finish = task->current_finish;
+    hclib_worker_state *ws = CURRENT_WS_INTERNAL;
+    if (task->produces && !claim_producer(ws, task)) {
+        /*
+         * It already ran inline in a waiter, we only held on to it for its
+         * deque entry and its check-in.
+         */
+        check_out_task(task, current_finish);
+        hclib_task_free(task);
+        return;
+    }
+
     /*
      * Update the current finish of this worker to be inherited from the
      * currently executing task so that any asyncs spawned from the currently
      * executing task are registered on the same finish.
      */
-    hclib_worker_state *ws = CURRENT_WS_INTERNAL;
     ws->current_finish = current_finish;
+    task->inline_parent = ws->curr_task;
     ws->curr_task = task;
 
 #ifdef VERBOSE
@@ -468,21 +851,53 @@ static inline void execute_task(hclib_task_t *task) {
 
     // task->_fp is of type 'void (*generic_frame_ptr)(void*)'
     (task->_fp)(task->args);
-    check_out_finish(current_finish);
+    check_out_task(task, current_finish);
+    // The task may have been resumed on another worker
+    CURRENT_WS_INTERNAL->curr_task = task->inline_parent;
 #ifndef HCLIB_INLINE_FUTURES_ONLY
     if (task->waiting_on_extra) {
         free(task->waiting_on_extra);
     }
 #endif
-    free(task);
+    hclib_task_free(task);
 }
 
 void hclib_default_queue_capacity(int* used, int* capacity) {
     const int wid = hclib_get_current_worker();
-    hclib_locale_t *default_locale = hc_context->graph->locales + 0;
+    hclib_locale_t *default_locale = default_spawn_locale(CURRENT_WS_INTERNAL);
     hclib_internal_deque_t * deq = &(default_locale->deques[wid].deque);
-    *used = deq->tail - deq->head;
-    *capacity = INIT_DEQUE_CAPACITY;
+    *used = deque_size(deq);
+    *capacity = deque_capacity(deq);
+}
+
+size_t hclib_get_deque_footprint(int *materialized_out) {
+    unsigned i;
+    int j;
+    size_t nbytes = 0;
+    int materialized = 0;
+    hclib_locality_graph *graph = hc_context->graph;
+
+    for (i = 0; i < graph->n_locales; i++) {
+        hclib_locale_t *locale = graph->locales + i;
+        if (locale->deques == NULL) continue;
+
+        nbytes += hc_context->nworkers * sizeof(*(locale->deques));
+        for (j = 0; j < hc_context->nworkers; j++) {
+            hclib_deque_t *deq = locale->deques + j;
+            size_t buffers = deque_footprint(&deq->deque);
+            int k;
+            for (k = 0; k < HCLIB_NUM_PRIORITIES - 1; k++) {
+                buffers += deque_footprint(deq->prio_lanes + k);
+            }
+            if (buffers > 0) {
+                materialized++;
+                nbytes += buffers;
+            }
+        }
+    }
+
+    if (materialized_out) *materialized_out = materialized;
+    return nbytes;
 }
 
 static inline void rt_schedule_async(hclib_task_t *async_task,
@@ -496,37 +911,77 @@ static inline void rt_schedule_async(hclib_task_t *async_task,
     worker_stats[ws->id].scheduled_tasks++;
 #endif
 
-    if (async_task->locale) {
+    hclib_locale_t *locale = async_task->locale;
+    if (locale) {
         // If task was explicitly created at a locale, place it there
-        if (!deque_push_locale(ws, async_task->locale, async_task)) {
-            assert(false);
-        }
+        deque_push_locale(ws, locale, async_task);
     } else {
         /*
          * If no explicit locale was provided, place it at a default location.
          * In the old implementation, each worker had the concept of a 'current'
-         * locale. For now we just place at locale 0 by default, but having a
-         * current locale might be a good thing to implement in the future.
-         * TODO.
+         * locale. For now we just place at locale 0 by default, or at the
+         * arena of this worker, but having a current locale might be a good
+         * thing to implement in the future. TODO.
          */
-        const int wid = hclib_get_current_worker();
 #ifdef VERBOSE
         fprintf(stderr, "rt_schedule_async: scheduling on worker wid=%d "
-                "hc_context=%p hc_context->graph=%p\n", wid, hc_context,
+                "hc_context=%p hc_context->graph=%p\n", ws->id, hc_context,
                 hc_context->graph);
 #endif
-        hclib_locale_t *default_locale = hc_context->graph->locales + 0;
-        assert(default_locale->reachable);
-        if (!deque_push(&(default_locale->deques[wid].deque),
-                    async_task)) {
-            // Deque is full
-            assert(false);
-        }
+        locale = default_spawn_locale(ws);
+        deque_push_locale(ws, locale, async_task);
 #ifdef VERBOSE
         fprintf(stderr, "rt_schedule_async: finished scheduling on worker "
-                "wid=%d\n", wid);
+                "wid=%d\n", ws->id);
 #endif
     }
+
+    notify_tasks_at(locale, 1);
+}
+
+/*
+ * Make the ntasks oldest latent tasks of this worker visible to thieves by
+ * pushing them to its deque at the default locale.
+ */
+static void promote_latent_tasks(hclib_worker_state *ws, unsigned ntasks) {
+    hclib_task_t *batch[HCLIB_LATENT_TASKS];
+    hclib_locale_t *locale = default_spawn_locale(ws);
+    unsigned i;
+
+    for (i = 0; i < ntasks; i++) {
+        batch[i] = ws->latent_tasks[(ws->latent_head + i) &
+            (HCLIB_LATENT_TASKS - 1)];
+    }
+    ws->latent_head += ntasks;
+    deque_push_batch_locale(ws, locale, (void **)batch, ntasks);
+    notify_tasks_at(locale, ntasks);
+#ifdef HCLIB_STATS
+    worker_stats[ws->id].promoted_tasks += ntasks;
+#endif
+}
+
+/*
+ * Called by push_latent_task and pop_latent_task every HCLIB_HEARTBEAT_POLL
+ * calls, when a thief asked for work, or when the ring of latent tasks is full.
+ * Thieves get half of our latent tasks, a heartbeat only promotes the oldest.
+ * If a thief asked while we had none, we keep polling until we spawn one.
+ */
+void poll_latent_tasks(hclib_worker_state *ws) {
+    const unsigned ntasks = ws->latent_tail - ws->latent_head;
+    if (ntasks == HCLIB_LATENT_TASKS) {
+        promote_latent_tasks(ws, ntasks / 2);
+    } else if (ws->latent_wanted && ntasks) {
+        ws->latent_wanted = 0;
+        promote_latent_tasks(ws, (ntasks + 1) / 2);
+    } else {
+        const unsigned long long now = current_time_ns();
+        if (now >= ws->next_heartbeat) {
+            ws->next_heartbeat = now + hc_context->heartbeat_ns;
+            if (ntasks) {
+                promote_latent_tasks(ws, 1);
+            }
+        }
+    }
 }
 
 /*
@@ -555,7 +1010,8 @@ static inline int is_eligible_to_schedule(hclib_task_t *async_task) {
  * runtime. See is_eligible_to_schedule to understand when a task is or isn't
  * eligible for scheduling.
  */
-void try_schedule_async(hclib_task_t *async_task, hclib_worker_state *ws) {
+static inline void try_schedule_async_inline(hclib_task_t *async_task,
+        hclib_worker_state *ws) {
 #ifdef VERBOSE
     fprintf(stderr, "try_schedule_async: async_task=%p ws=%p\n", async_task, ws);
 #endif
@@ -569,11 +1025,166 @@ void try_schedule_async(hclib_task_t *async_task, hclib_worker_state *ws) {
     }
 }
 
+static inline hclib_locale_t *released_task_locale(hclib_task_t *task,
+        hclib_worker_state *ws) {
+    return task->locale ? task->locale : default_spawn_locale(ws);
+}
+
+/*
+ * Schedule n tasks whose last future was just satisfied by a put on ws. Each
+ * goes to its own locale, as in rt_schedule_async, but consecutive tasks for
+ * the same locale and priority are published to thieves with a single deque
+ * push, and sleeping workers are woken up once per such run, as many as there
+ * are tasks in it.
+ */
+void schedule_released_tasks(hclib_task_t **tasks, int n,
+        hclib_worker_state *ws) {
+    int start = 0;
+
+    if (ws == NULL) {
+        // A promise was put from a thread that is not one of our workers
+        for (start = 0; start < n; start++) {
+            locale_inject_task(tasks[start]->locale, tasks[start]);
+        }
+        return;
+    }
+
+#ifdef HCLIB_STATS
+    worker_stats[ws->id].scheduled_tasks += n;
+#endif
+
+    while (start < n) {
+        hclib_locale_t *locale = released_task_locale(tasks[start], ws);
+        const int priority = tasks[start]->priority;
+        int end = start + 1;
+        while (end < n && tasks[end]->priority == priority &&
+                released_task_locale(tasks[end], ws) == locale) {
+            end++;
+        }
+
+        if (end - start == 1) {
+            deque_push_locale(ws, locale, tasks[start]);
+        } else {
+            deque_push_batch_locale(ws, locale, (void **)(tasks + start),
+                    end - start);
+        }
+        notify_tasks_at(locale, end - start);
+        start = end;
+    }
+}
+
+static void work_first_helper(LiteCtx *ctx) {
+    hclib_task_t *child = ctx->arg1;
+    HASSERT(child);
+
+    /*
+     * Now that the parent's context is no longer running, it can be resumed
+     * from our deque, by us once the child completes or by a thief.
+     */
+    hclib_task_t *continuation = (hclib_task_t *)hclib_task_alloc(
+            sizeof(*continuation));
+    continuation->_fp = _finish_ctx_resume;
+    continuation->args = ctx->prev;
+    rt_schedule_async(continuation, CURRENT_WS_INTERNAL);
+
+    core_work_loop(child);
+    HASSERT(0);
+}
+
+/*
+ * Suspend the task running on this worker and run task, which it just spawned,
+ * on a fresh context. As in yield, the parent is resumed through a
+ * continuation task.
+ */
+static void spawn_work_first(hclib_worker_state *ws, hclib_task_t *task) {
+    finish_t *old_finish = ws->current_finish;
+    hclib_task_t *old_task = ws->curr_task;
+
+#ifdef HCLIB_STATS
+    worker_stats[ws->id].work_first_spawns++;
+    worker_stats[ws->id].count_ctx_creates++;
+#endif
+
+    transfer_suspended_task(old_task);
+
+    LiteCtx *currentCtx = get_curr_lite_ctx();
+    HASSERT(currentCtx);
+    LiteCtx *newCtx = ctx_create(work_first_helper);
+    newCtx->arg1 = task;
+    ctx_swap(currentCtx, newCtx, __func__);
+
+    ctx_destroy(currentCtx->prev);
+
+    ws = CURRENT_WS_INTERNAL;
+    ws->current_finish = old_finish;
+    ws->curr_task = old_task;
+}
+
+/*
+ * Whether a task spawned on this worker can be run work-first. Its parent has
+ * to be a task that may block, running on a context of its own rather than on
+ * the system stack, and not too deep a chain of suspended tasks.
+ */
+static inline int can_spawn_work_first(hclib_worker_state *ws,
+        hclib_task_t *task) {
+    hclib_task_t *parent = ws->curr_task;
+    if (parent == NULL) return 0;
+
+    task->work_first_depth = parent->work_first_depth;
+    if (task->locale != ws->paths->arena ||
+            task->priority != HCLIB_PRIORITY_DEFAULT ||
+            parent->non_blocking || ws->curr_ctx == ws->root_ctx ||
+            parent->work_first_depth >= HCLIB_WORK_FIRST_MAX_DEPTH) {
+        return 0;
+    }
+    task->work_first_depth++;
+    return 1;
+}
+
+/*
+ * Spawn a task that is registered on the current finish scope and does not
+ * wait on any futures, which is the case for the vast majority of tasks. It
+ * is immediately ready, so skip straight to placing it in a deque.
+ */
+static inline void spawn_ready(hclib_task_t *task, hclib_locale_t *locale) {
+    HASSERT(task);
+
+    hclib_worker_state *ws = CURRENT_WS_INTERNAL;
+    check_in_task(ws, task);
+    if (locale) {
+        task->locale = locale;
+    } else if (task->locale == NULL) {
+        // Tasks spawned in an arena stay there, whoever schedules them
+        task->locale = ws->paths->arena;
+    }
+
+#ifdef HCLIB_STATS
+    worker_stats[ws->id].spawned_tasks++;
+#endif
+
+    if (hc_context->work_first && can_spawn_work_first(ws, task)) {
+        spawn_work_first(ws, task);
+        return;
+    }
+    if (ws->latent_tasks && task->locale == ws->paths->arena &&
+            task->priority == HCLIB_PRIORITY_DEFAULT) {
+        push_latent_task(ws, task);
+        return;
+    }
+    rt_schedule_async(task, ws);
+}
+
 void spawn_handler(hclib_task_t *task, hclib_locale_t *locale,
         hclib_future_t **futures, const int nfutures, const int escaping) {
     HASSERT(task);
 
+    if (nfutures == 0 && !escaping) {
+        spawn_ready(task, locale);
+        return;
+    }
+
     hclib_worker_state *ws = CURRENT_WS_INTERNAL;
+    task->deferred_checkin = 0;
     if (escaping) {
         // If escaping task, don't register with current finish
         set_current_finish(task, NULL);
@@ -584,6 +1195,9 @@ void spawn_handler(hclib_task_t *task, hclib_locale_t *locale,
 
     if (locale) {
         task->locale = locale;
+    } else if (task->locale == NULL) {
+        // Tasks spawned in an arena stay there, whoever schedules them
+        task->locale = ws->paths->arena;
     }
 
     if (nfutures > 0) {
@@ -613,15 +1227,40 @@ void spawn_handler(hclib_task_t *task, hclib_locale_t *locale,
     fprintf(stderr, "spawn_handler: task=%p escaping=%d\n", task, escaping);
 #endif
 
-    try_schedule_async(task, ws);
+    if (ws->latent_tasks && task->locale == ws->paths->arena &&
+            task->priority == HCLIB_PRIORITY_DEFAULT) {
+        /*
+         * A ready escaping task, e.g. the continuation of a yield, can stay
+         * latent like any other task this worker spawns.
+         */
+#ifdef HCLIB_STATS
+        worker_stats[ws->id].spawned_tasks++;
+#endif
+        if (is_eligible_to_schedule(task)) {
+            push_latent_task(ws, task);
+        }
+        return;
+    }
+    try_schedule_async_inline(task, ws);
+}
+
+void hclib_task_set_producer(hclib_task_t *task, hclib_promise_t *promise) {
+    /*
+     * Waiters may look at the task after it completed, so its memory must not
+     * go back to the system allocator.
+     */
+    if (hclib_task_in_slab(task)) {
+        task->produces = promise;
+        promise->producer = task;
+    }
 }
 
 void spawn_at(hclib_task_t *task, hclib_locale_t *locale) {
-    spawn_handler(task, locale, NULL, 0, 0);
+    spawn_ready(task, locale);
 }
 
 void spawn(hclib_task_t *task) {
-    spawn_handler(task, NULL, NULL, 0, 0);
+    spawn_ready(task, NULL);
 }
 
 void spawn_escaping(hclib_task_t *task, hclib_future_t *future) {
@@ -643,37 +1282,241 @@ void spawn_await(hclib_task_t *task, hclib_future_t **futures,
     spawn_await_at(task, futures, nfutures, NULL);
 }
 
+/*
+ * Elastic worker count. Workers with an ID of hc_context->nactive or more
+ * retire from the work loop: they hand the tasks queued on them to the other
+ * workers, and sleep on retired_ec, where new work does not wake them up, until
+ * they are reactivated or the runtime shuts down. Worker 0 never retires.
+ */
+static inline int worker_is_active(hclib_worker_state *ws) {
+    return ws->id < hc_context->nactive;
+}
+
+/*
+ * Hand our tasks to the active workers and sleep until reactivated. Returns a
+ * task if one shows up at a locale only this worker takes care of, see
+ * locale_find_retired_task.
+ */
+static hclib_task_t *retire_worker(hclib_worker_state *ws) {
+    volatile int *done_flag = &(hc_context->done_flags[ws->id].flag);
+    hclib_eventcount_t *retired_ec = hc_context->retired_ec;
+    hclib_task_t *task = NULL;
+
+    ws->retired = 1;
+    if (ws->latent_tasks && ws->latent_tail != ws->latent_head) {
+        promote_latent_tasks(ws, ws->latent_tail - ws->latent_head);
+    }
+#ifdef HCLIB_STATS
+    worker_stats[ws->id].count_retires++;
+#endif
+
+    while (*done_flag && !worker_is_active(ws)) {
+        /*
+         * Again every time around, as locales we kept may have been taken
+         * over by reactivated workers in the meantime.
+         */
+        locale_hand_off_tasks(ws);
+        answer_steal_request(ws);
+        if ((task = locale_find_retired_task(ws))) {
+            break;
+        }
+        /*
+         * Before going to sleep, wait for thieves that were taking tasks from
+         * us to transfer them. Tasks we kept may be holding this up too, and
+         * are run first.
+         */
+        if (ws->deferred_finish && !release_deferred_finish(ws)) {
+            hc_cpu_relax();
+            continue;
+        }
+
+        const unsigned key = hclib_ec_prepare_wait(retired_ec, 0);
+        if (!*done_flag || worker_is_active(ws)) {
+            hclib_ec_cancel_wait(retired_ec, 0);
+            break;
+        }
+        if ((task = locale_find_retired_task(ws))) {
+            hclib_ec_cancel_wait(retired_ec, 0);
+            break;
+        }
+        hclib_ec_wait(retired_ec, key, 0);
+    }
+    ws->retired = 0;
+    return task;
+}
+
+/*
+ * Load-based controller, see HCLIB_ELASTIC_IDLE_US. The highest numbered active
+ * worker retires once it went without work for long enough, which it notices
+ * when about to park. A worker with tasks piling up on it reactivates one.
+ */
+static inline int elastic_shrink(hclib_worker_state *ws,
+        unsigned long long idle_since) {
+    const int id = ws->id;
+    return id > 0 && id == hc_context->nactive - 1 &&
+        current_time_ns() - idle_since >= hc_context->elastic_idle_ns &&
+        __sync_bool_compare_and_swap(&hc_context->nactive, id + 1, id);
+}
+
+static void elastic_grow(hclib_worker_state *ws) {
+    const int nactive = hc_context->nactive;
+    if (nactive < hc_context->max_active &&
+            workers_backlog(ws) >= HCLIB_ELASTIC_GROW_BACKLOG &&
+            __sync_bool_compare_and_swap(&hc_context->nactive, nactive,
+                nactive + 1)) {
+        hclib_ec_notify(hc_context->retired_ec, -1);
+    }
+}
+
+int hclib_get_num_active_workers() {
+    return hc_context->nactive;
+}
+
+void hclib_set_num_active_workers(int n) {
+    if (n < 1) n = 1;
+    if (n > hc_context->nworkers) n = hc_context->nworkers;
+
+    hc_context->max_active = n;
+    hc_context->nactive = n;
+    hc_mfence();
+    // Wake up those who have to retire, and those who are reactivated
+    hclib_ec_wake(hc_context->idle_ec, -1);
+    hclib_ec_wake(hc_context->retired_ec, -1);
+}
+
+/*
+ * Pause for a number of cycles that grows exponentially with the number of
+ * consecutive failed steal attempts.
+ */
+static inline void idle_backoff(int nfailed) {
+    const int npauses = 1 << (nfailed < 8 ? nfailed : 8);
+    for (int i = 0; i < npauses; i++) {
+        hc_cpu_relax();
+    }
+}
+
+/*
+ * Look for work until *flag == flag_val. After spin_before_park consecutive
+ * failed steals the worker goes to sleep on hc_context->idle_ec, from which it
+ * is woken when new tasks are scheduled or (if flag is not the worker's done
+ * flag) when a finish scope or future it may be waiting on is satisfied.
+ */
 static hclib_task_t *find_and_run_task(hclib_worker_state *ws,
         const int on_fresh_ctx, volatile int *flag, const int flag_val,
         finish_t *current_finish) {
     hclib_task_t *stolen[STEAL_CHUNK_SIZE];
-    hclib_task_t *task = locale_pop_task(ws);
+    hclib_task_t *task = NULL;
+    // Whether we were called from core_work_loop, rather than a blocked task
+    const int in_work_loop = (flag == &(hc_context->done_flags[ws->id].flag));
+
+    /*
+     * Tasks pile up just as well on a worker that runs them while blocked in a
+     * finish scope or on a future, which is where the root task spawns from.
+     */
+    if (hc_context->elastic_idle_ns &&
+            (++ws->elastic_polls & (HCLIB_ELASTIC_POLL - 1)) == 0) {
+        elastic_grow(ws);
+    }
+
+    if (in_work_loop) {
+        /*
+         * Look for tasks injected from outside the runtime between any two
+         * tasks, or they would wait behind everything our own tasks spawn.
+         */
+        task = locale_drain_injected(ws);
+    }
+    if (!task) {
+        task = locale_pop_task(ws);
+    }
 
     if (!task) {
+        hclib_eventcount_t *idle_ec = hc_context->idle_ec;
+        const int spin_before_park = hc_context->spin_before_park;
+        const int on_flag = !in_work_loop;
+        const unsigned long long idle_since = (in_work_loop &&
+                hc_context->elastic_idle_ns ? current_time_ns() : 0);
+        int nfailed = 0;
+
         while (*flag != flag_val) {
+            if (in_work_loop && !worker_is_active(ws)) {
+                // Back to core_work_loop, to retire
+                break;
+            }
+
+            /*
+             * Once we have spun for long enough, announce that we are about to
+             * sleep before making one last attempt at finding work. Anyone
+             * producing work from then on will see us and wake us up.
+             */
+            const int parking = (spin_before_park >= 0 &&
+                    nfailed >= spin_before_park);
+            unsigned key = 0;
+            if (parking) {
+                key = hclib_ec_prepare_wait(idle_ec, on_flag);
+            }
+
+            /*
+             * Our deques are empty, so any tasks we deferred check-ins for
+             * have completed or left this worker.
+             */
+            if (ws->deferred_finish) {
+                release_deferred_finish(ws);
+            }
+
+            if ((task = locale_drain_injected(ws))) {
+                if (parking) {
+                    hclib_ec_cancel_wait(idle_ec, on_flag);
+                }
+                break;
+            }
+
             // try to steal
-            // task = locale_steal_task(ws);
             int victim;
             const int nstolen = locale_steal_task(ws, (void **)stolen, &victim);
             if (nstolen) {
+                if (parking) {
+                    hclib_ec_cancel_wait(idle_ec, on_flag);
+                }
 #ifdef HCLIB_STATS
                 worker_stats[ws->id].count_steals++;
                 worker_stats[ws->id].stolen_tasks += nstolen;
                 worker_stats[ws->id].stolen_tasks_per_thread[victim] += nstolen;
 #endif
                 task = stolen[0];
-                for (int i = 1; i < nstolen; i++) {
-                    rt_schedule_async(stolen[i], ws);
-                }
                 break;
             }
+
+            if (parking) {
+                if (*flag == flag_val) {
+                    hclib_ec_cancel_wait(idle_ec, on_flag);
+                } else if (idle_since && elastic_shrink(ws, idle_since)) {
+                    hclib_ec_cancel_wait(idle_ec, on_flag);
+                    break;
+                } else {
+#ifdef HCLIB_STATS
+                    worker_stats[ws->id].count_parks++;
+#endif
+                    hclib_ec_wait(idle_ec, key, on_flag);
+                }
+                nfailed = 0;
+            } else {
+                idle_backoff(nfailed++);
+            }
         }
     }
 
     if (task == NULL) {
         return NULL;
-    } else if (task && (on_fresh_ctx || task->non_blocking ||
-                (task->current_finish && task->current_finish == current_finish))) {
+    } else if (task->_fp == _finish_ctx_resume && !in_work_loop) {
+        /*
+         * Resuming a continuation abandons the current context for good, which
+         * is only safe from the work loop. Anywhere else the current context
+         * still has live frames above it (e.g. the help_finish we were called
+         * from), so make our caller switch to a fresh context first.
+         */
+        return task;
+    } else if (on_fresh_ctx || task->non_blocking ||
+                (task->current_finish && task->current_finish == current_finish)) {
         /*
          * If the retrieved task is either:
          *
@@ -703,6 +1546,8 @@ static void _hclib_finalize_ctx(LiteCtx *ctx) {
 }
 
 static void core_work_loop(hclib_task_t *starting_task) {
+    // Whatever ran before on this worker is suspended on another context
+    CURRENT_WS_INTERNAL->curr_task = NULL;
     if (starting_task) {
         execute_task(starting_task);
     }
@@ -711,6 +1556,13 @@ static void core_work_loop(hclib_task_t *starting_task) {
     do {
         hclib_worker_state *ws = CURRENT_WS_INTERNAL;
         wid = (uint64_t)ws->id;
+        if (!worker_is_active(ws)) {
+            hclib_task_t *task = retire_worker(ws);
+            if (task) {
+                execute_task(task);
+            }
+            continue;
+        }
         hclib_task_t *must_be_null = find_and_run_task(ws, 1,
                 &(hc_context->done_flags[wid].flag), 0, NULL);
         HASSERT(must_be_null == NULL);
@@ -924,7 +1776,7 @@ static void *worker_routine(void *args) {
      * Create the new proxy we will be switching to, which will start with
      * crt_work_loop at the top of the stack.
      */
-    LiteCtx *newCtx = LiteCtx_create(crt_work_loop);
+    LiteCtx *newCtx = ctx_create(crt_work_loop);
     newCtx->arg1 = args;
 #ifdef HCLIB_STATS
     worker_stats[CURRENT_WS_INTERNAL->id].count_ctx_creates++;
@@ -939,7 +1791,7 @@ static void *worker_routine(void *args) {
 #endif
 
     // free resources
-    LiteCtx_destroy(currentCtx->prev);
+    ctx_destroy(currentCtx->prev);
     LiteCtx_proxy_destroy(currentCtx);
     return NULL;
 }
@@ -947,6 +1799,14 @@ static void *worker_routine(void *args) {
 static void _finish_ctx_resume(void *arg) {
     LiteCtx *currentCtx = get_curr_lite_ctx();
     LiteCtx *finishCtx = arg;
+
+    /*
+     * The task running this function never returns to execute_task, so it has
+     * to be released before switching away.
+     */
+    hclib_task_t *self = CURRENT_WS_INTERNAL->curr_task;
+    HASSERT(self->args == arg);
+    hclib_task_free(self);
     ctx_swap(currentCtx, finishCtx, __func__);
 
 #ifdef VERBOSE
@@ -965,8 +1825,7 @@ void _help_wait(LiteCtx *ctx) {
     hclib_task_t *starting_task = ctx->arg2;
     LiteCtx *wait_ctx = ctx->prev;
 
-    hclib_task_t *task = calloc(1, sizeof(*task));
-    HASSERT(task);
+    hclib_task_t *task = hclib_task_alloc(sizeof(*task));
     task->_fp = _finish_ctx_resume; // reuse _finish_ctx_resume
     task->args = wait_ctx;
 
@@ -976,6 +1835,101 @@ void _help_wait(LiteCtx *ctx) {
     HASSERT(0);
 }
 
+/*
+ * Whether there is room left on the current context's stack to run a producer
+ * inline. Producers nest there when they wait in turn, so past half of the
+ * stack we suspend instead, and the producer runs on a context of its own.
+ */
+static inline int can_nest_inline(hclib_worker_state *ws) {
+    LiteCtx *ctx = ws->curr_ctx;
+    // Proxy contexts run on a stack whose bounds we do not know
+    if (ctx == NULL || ctx->_stack == NULL) return 0;
+    const char *sp = (const char *)__builtin_frame_address(0);
+    return sp > ctx->_stack &&
+        (size_t)(sp - ctx->_stack) > ctx->_stack_size / 2;
+}
+
+/*
+ * Run the task that will satisfy promise right here if nobody started it yet,
+ * which saves us from suspending. Its deque entry is released by whoever takes
+ * it later, see execute_task. If it is running on another worker, steal from
+ * that worker first, since whatever it spawned is what we are waiting for.
+ */
+static int run_producer_inline(hclib_worker_state *ws,
+        hclib_promise_t *promise) {
+    hclib_task_t *task = promise->producer;
+    if (task == NULL) return 0;
+
+    /*
+     * task may have completed and been reused for another task since we read
+     * it. Producers are only ever taken from the task slabs, whose blocks stay
+     * tasks, but check that before touching its claim (see
+     * hclib_task_set_producer). Then claim it tentatively and check it is still
+     * our producer before going any further.
+     */
+    if (!hclib_task_in_slab(task)) return 0;
+    const int claim = task->producer_claim;
+    if (claim > 0) {
+        // Stale if task was reused, so only a hint of whom to steal from
+        if (claim - 1 != ws->id && claim - 1 < hc_context->nworkers) {
+            ws->last_victim = claim - 1;
+        }
+        return 0;
+    }
+    if (claim != 0 || !can_nest_inline(ws) ||
+            !__sync_bool_compare_and_swap(&task->producer_claim, 0,
+                PRODUCER_CLAIM_TENTATIVE)) {
+        return 0;
+    }
+    if (promise->producer != task || (task->locale != ws->paths->arena &&
+                (ws->paths->arena || task->locale->is_arena)) ||
+            (task->locale && !path_contains(ws->paths->pop_path,
+                                            task->locale))) {
+        /*
+         * Also leave it be if it belongs to another arena, or to an arena
+         * while we do not, or was placed at a locale we do not pop from.
+         */
+        __sync_bool_compare_and_swap(&task->producer_claim,
+                PRODUCER_CLAIM_TENTATIVE, 0);
+        return 0;
+    }
+    promise->producer = NULL;
+    task->producer_claim = ws->id + 1;
+
+#ifdef HCLIB_STATS
+    worker_stats[ws->id].inline_producers++;
+#endif
+
+    /*
+     * task stays checked in until its deque entry is released, so as far as
+     * suspending goes we are still running the waiting task.
+     */
+    finish_t *current_finish = ws->current_finish;
+    ws->current_finish = task->current_finish;
+    (task->_fp)(task->args);
+    // As in help_finish, we may have moved to another worker
+    CURRENT_WS_INTERNAL->current_finish = current_finish;
+    return 1;
+}
+
+/*
+ * Threads that are not HClib workers have no tasks to run while they wait, so
+ * they sleep on the same eventcount as idle workers. Satisfying a promise wakes
+ * up everyone waiting for a flag there.
+ */
+static void *future_wait_external(hclib_future_t *future) {
+    hclib_eventcount_t *idle_ec = hc_context->idle_ec;
+    while (!future->owner->satisfied) {
+        const unsigned key = hclib_ec_prepare_wait(idle_ec, 1);
+        if (future->owner->satisfied) {
+            hclib_ec_cancel_wait(idle_ec, 1);
+            break;
+        }
+        hclib_ec_wait(idle_ec, key, 1);
+    }
+    return future->owner->datum;
+}
+
 int hclib_future_is_satisfied(hclib_future_t *future) {
     return future->owner->satisfied;
 }
@@ -985,26 +1939,37 @@ void *hclib_future_wait(hclib_future_t *future) {
         return (void *)future->owner->datum;
     }
 
+    // save current finish scope (in case of worker swap)
+    hclib_worker_state *ws = CURRENT_WS_INTERNAL;
+    if (ws == NULL) {
+        return future_wait_external(future);
+    }
+
 #ifdef HCLIB_STATS
-    worker_stats[CURRENT_WS_INTERNAL->id].count_future_waits++;
+    worker_stats[ws->id].count_future_waits++;
 #endif
 
-    // save current finish scope (in case of worker swap)
-    hclib_worker_state *ws = CURRENT_WS_INTERNAL;
     finish_t *current_finish = ws->current_finish;
     hclib_task_t *current_task = ws->curr_task;
 
+    if (run_producer_inline(ws, future->owner) && future->owner->satisfied) {
+        return future->owner->datum;
+    }
+
     hclib_task_t *need_to_swap_ctx = NULL;
     while (future->owner->satisfied == 0 &&
             need_to_swap_ctx == NULL) {
-        need_to_swap_ctx = find_and_run_task(ws, 0,
+        // As in help_finish, we may have moved to another worker
+        need_to_swap_ctx = find_and_run_task(CURRENT_WS_INTERNAL, 0,
                 &(future->owner->satisfied), 1, NULL);
     }
 
     if (need_to_swap_ctx) {
+        transfer_suspended_task(current_task);
+
         LiteCtx *currentCtx = get_curr_lite_ctx();
         HASSERT(currentCtx);
-        LiteCtx *newCtx = LiteCtx_create(_help_wait);
+        LiteCtx *newCtx = ctx_create(_help_wait);
         newCtx->arg1 = future;
         newCtx->arg2 = need_to_swap_ctx;
 
@@ -1013,7 +1978,7 @@ void *hclib_future_wait(hclib_future_t *future) {
 #endif
 
         ctx_swap(currentCtx, newCtx, __func__);
-        LiteCtx_destroy(currentCtx->prev);
+        ctx_destroy(currentCtx->prev);
     }
     // restore current finish scope (in case of worker swap)
     ws = CURRENT_WS_INTERNAL;
@@ -1043,9 +2008,7 @@ static void _help_finish_ctx(LiteCtx *ctx) {
     HASSERT(finish && starting_task);
     LiteCtx *hclib_finish_ctx = ctx->prev;
 
-    hclib_task_t *task = (hclib_task_t *)calloc(
-            1, sizeof(*task));
-    HASSERT(task);
+    hclib_task_t *task = (hclib_task_t *)hclib_task_alloc(sizeof(*task));
     task->_fp = _finish_ctx_resume;
     task->args = hclib_finish_ctx;
 
@@ -1064,7 +2027,7 @@ static void _help_finish_ctx(LiteCtx *ctx) {
     HASSERT(0); // we should never return here
 }
 
-void help_finish(finish_t *finish) {
+void help_finish(finish_t *finish, hclib_task_t *current_task) {
     /*
      * Creating a new context to switch to is necessary here because the
      * current context needs to become the continuation for this finish
@@ -1072,6 +2035,16 @@ void help_finish(finish_t *finish) {
      * async is created inside _help_finish_ctx).
      */
 
+    hclib_worker_state *ws = CURRENT_WS_INTERNAL;
+    if (ws->deferred_finish == finish) {
+        /*
+         * Our reference may be all that is left, e.g. in work-first mode where
+         * the tasks we deferred have all run already. Otherwise we would look
+         * for other work before dropping it.
+         */
+        release_deferred_finish(ws);
+    }
+
     if (finish->counter == 1) {
         /*
          * Quick optimization: if no asyncs remain in this finish scope, just
@@ -1081,20 +2054,25 @@ void help_finish(finish_t *finish) {
         return;
     }
 
-    hclib_worker_state *ws = CURRENT_WS_INTERNAL;
     hclib_task_t *need_to_swap_ctx = NULL;
     while (finish->counter > 1 && need_to_swap_ctx == NULL) {
-        need_to_swap_ctx = find_and_run_task(ws, 1, &(finish->counter), 1,
-                finish);
+        /*
+         * A task run from here may have been suspended and resumed us on
+         * another worker, so look up the current worker every time.
+         */
+        need_to_swap_ctx = find_and_run_task(CURRENT_WS_INTERNAL, 1,
+                &(finish->counter), 1, finish);
     }
 
     if (need_to_swap_ctx) {
+        transfer_suspended_task(current_task);
+
         // create finish event
-        hclib_promise_t *finish_promise = hclib_promise_create();
-        finish->finish_dep = &finish_promise->future;
+        hclib_promise_init(&finish->promise);
+        finish->finish_dep = &finish->promise.future;
         LiteCtx *currentCtx = get_curr_lite_ctx();
         HASSERT(currentCtx);
-        LiteCtx *newCtx = LiteCtx_create(_help_finish_ctx);
+        LiteCtx *newCtx = ctx_create(_help_finish_ctx);
         newCtx->arg1 = finish;
         newCtx->arg2 = need_to_swap_ctx;
 #ifdef HCLIB_STATS
@@ -1109,8 +2087,7 @@ void help_finish(finish_t *finish) {
          * destroy the context that resumed this one since it's now defunct
          * (there are no other handles to it, and it will never be resumed)
          */
-        LiteCtx_destroy(currentCtx->prev);
-        hclib_promise_free(finish_promise);
+        ctx_destroy(currentCtx->prev);
 
         HASSERT(finish->counter == 0);
     } else {
@@ -1123,9 +2100,8 @@ static void yield_helper(LiteCtx *ctx) {
     HASSERT(starting_task);
     hclib_locale_t *locale = ctx->arg2;
 
-    hclib_task_t *continuation = (hclib_task_t *)calloc(1,
+    hclib_task_t *continuation = (hclib_task_t *)hclib_task_alloc(
             sizeof(*continuation));
-    HASSERT(continuation);
     continuation->_fp = _finish_ctx_resume;
     continuation->args = ctx->prev;
 
@@ -1170,14 +2146,11 @@ void hclib_yield(hclib_locale_t *locale) {
                 worker_stats[ws->id].stolen_tasks_per_thread[victim] += nstolen;
 #endif
                 /*
-                 * If the steal is successful, take one of those tasks to run
-                 * (stolen[0]) and push the rest back in to the work stealing
-                 * system.
+                 * If the steal is successful, run the first of the stolen
+                 * tasks (stolen[0]). The rest were already placed in our own
+                 * deques by locale_steal_task.
                  */
                 task = stolen[0];
-                for (int i = 1; i < nstolen; i++) {
-                    rt_schedule_async(stolen[i], ws);
-                }
             }
         }
 
@@ -1185,9 +2158,11 @@ void hclib_yield(hclib_locale_t *locale) {
             if (task->non_blocking) {
                 execute_task(task);
             } else {
+                transfer_suspended_task(old_task);
+
                 LiteCtx *currentCtx = get_curr_lite_ctx();
                 HASSERT(currentCtx);
-                LiteCtx *newCtx = LiteCtx_create(yield_helper);
+                LiteCtx *newCtx = ctx_create(yield_helper);
                 newCtx->arg1 = task;
                 newCtx->arg2 = locale;
 #ifdef HCLIB_STATS
@@ -1195,7 +2170,7 @@ void hclib_yield(hclib_locale_t *locale) {
 #endif
                 ctx_swap(currentCtx, newCtx, __func__);
 
-                LiteCtx_destroy(currentCtx->prev);
+                ctx_destroy(currentCtx->prev);
 
                 /*
                  * This break is necessary to prevent infinite loops. If there
@@ -1216,10 +2191,37 @@ void hclib_yield(hclib_locale_t *locale) {
     ws->curr_task = old_task;
 }
 
+/*
+ * Finish scopes are recycled through a small per-worker pool, since recursive
+ * programs enter and leave them about as often as they spawn tasks. A finish
+ * may be released on a different worker than the one it was taken from.
+ */
+static inline finish_t *finish_alloc(hclib_worker_state *ws) {
+    finish_t *finish = ws->finish_pool;
+    if (finish) {
+        ws->finish_pool = finish->pool_next;
+        ws->finish_pool_size--;
+    } else {
+        finish = (finish_t *)malloc(sizeof(*finish));
+        HASSERT(finish);
+    }
+    finish->finish_dep = NULL;
+    return finish;
+}
+
+static inline void finish_release(hclib_worker_state *ws, finish_t *finish) {
+    if (ws->finish_pool_size < HCLIB_FINISH_POOL_SIZE) {
+        finish->pool_next = ws->finish_pool;
+        ws->finish_pool = finish;
+        ws->finish_pool_size++;
+    } else {
+        free(finish);
+    }
+}
+
 void hclib_start_finish() {
     hclib_worker_state *ws = CURRENT_WS_INTERNAL;
-    finish_t *finish = (finish_t *)calloc(1, sizeof(*finish));
-    HASSERT(finish);
+    finish_t *finish = finish_alloc(ws);
     /*
      * Set finish counter to 1 initially to emulate the main thread inside the
      * finish being a task registered on the finish. When we reach the
@@ -1260,7 +2262,7 @@ void hclib_end_finish() {
 
     HASSERT(current_finish);
     HASSERT(current_finish->counter > 0);
-    help_finish(current_finish);
+    help_finish(current_finish, current_task);
 
     check_out_finish(current_finish->parent); // NULL check in check_out_finish
 
@@ -1273,7 +2275,7 @@ void hclib_end_finish() {
     ws = CURRENT_WS_INTERNAL;
     ws->current_finish = current_finish->parent;
     ws->curr_task = current_task;
-    free(current_finish);
+    finish_release(ws, current_finish);
 }
 
 // Based on help_finish
@@ -1307,7 +2309,7 @@ void hclib_end_finish_nonblocking_helper(hclib_promise_t *event) {
 }
 
 hclib_future_t *hclib_end_finish_nonblocking() {
-    hclib_promise_t *event = hclib_promise_create();
+    hclib_promise_t *event = hclib_promise_create_shared(2);
     hclib_end_finish_nonblocking_helper(event);
     return &event->future;
 }
@@ -1375,8 +2377,14 @@ void hclib_print_runtime_stats(FILE *fp) {
     size_t sum_future_waits = 0;
     size_t sum_end_finishes_nonblocking = 0;
     size_t sum_ctx_creates = 0;
+    size_t sum_ctx_allocs = 0;
     size_t sum_yields = 0;
     size_t sum_yield_iters = 0;
+    size_t sum_parks = 0;
+    size_t sum_promoted = 0;
+    size_t sum_work_first = 0;
+    size_t sum_inline_producers = 0;
+    size_t sum_retires = 0;
     size_t sum_tasks = 0;
     for (i = 0; i < hc_context->nworkers; i++) {
         printf("  Worker %d: %lu tasks executed, %lu tasks spawned, "
@@ -1394,24 +2402,45 @@ void hclib_print_runtime_stats(FILE *fp) {
         sum_future_waits += worker_stats[i].count_future_waits;
         sum_end_finishes_nonblocking += worker_stats[i].count_end_finishes_nonblocking;
         sum_ctx_creates += worker_stats[i].count_ctx_creates;
+        sum_ctx_allocs += worker_stats[i].count_ctx_allocs;
         sum_yields += worker_stats[i].count_yields;
         sum_yield_iters += worker_stats[i].count_yield_iterations;
+        sum_parks += worker_stats[i].count_parks;
+        sum_promoted += worker_stats[i].promoted_tasks;
+        sum_work_first += worker_stats[i].work_first_spawns;
+        sum_inline_producers += worker_stats[i].inline_producers;
+        sum_retires += worker_stats[i].count_retires;
         sum_tasks += worker_stats[i].executed_tasks;
     }
 
     printf("Total: %lu tasks, %lu end finishes, %lu future waits, "
-            "%lu non-blocking end finishes, %lu ctx creates, %lu yields, "
-            "%f iters per yield on average\n", sum_tasks, sum_end_finishes,
-            sum_future_waits, sum_end_finishes_nonblocking, sum_ctx_creates,
-            sum_yields,
+            "%lu non-blocking end finishes, %lu ctx creates (%lu allocated), "
+            "%lu yields, %f iters per yield on average\n", sum_tasks,
+            sum_end_finishes, sum_future_waits, sum_end_finishes_nonblocking,
+            sum_ctx_creates, sum_ctx_allocs, sum_yields,
             sum_yields == 0 ? 0.0 : (double)sum_yield_iters / (double)sum_yields);
+    printf("Idle workers parked %lu times\n", sum_parks);
+    printf("Producers run inline by waiters: %lu\n", sum_inline_producers);
+    if (hc_context->heartbeat_ns) {
+        printf("Latent tasks promoted: %lu\n", sum_promoted);
+    }
+    if (hc_context->work_first) {
+        printf("Spawns run work-first: %lu\n", sum_work_first);
+    }
+    if (sum_retires) {
+        printf("Workers retired %lu times\n", sum_retires);
+    }
+    int materialized;
+    const size_t footprint = hclib_get_deque_footprint(&materialized);
+    printf("Deques: %d of %u materialized, %lu bytes\n", materialized,
+            hc_context->graph->n_locales * hc_context->nworkers, footprint);
     free(worker_stats);
 #endif
 }
 
 void hclib_finalize(const int instrument) {
     LiteCtx *finalize_ctx = LiteCtx_proxy_create(__func__);
-    LiteCtx *finish_ctx = LiteCtx_create(_hclib_finalize_ctx);
+    LiteCtx *finish_ctx = ctx_create(_hclib_finalize_ctx);
 #ifdef HCLIB_STATS
     worker_stats[CURRENT_WS_INTERNAL->id].count_ctx_creates++;
 #endif
@@ -1422,13 +2451,18 @@ void hclib_finalize(const int instrument) {
         ctx_swap(finalize_ctx, save_context, __func__);
     }
     // free resources
-    LiteCtx_destroy(finalize_ctx->prev);
+    ctx_destroy(finalize_ctx->prev);
     LiteCtx_proxy_destroy(finalize_ctx);
 
     hclib_join(hc_context->nworkers);
 
     hclib_print_runtime_stats(stdout);
 
+    if (profile_launch_body) {
+        printf("\nHCLIB DEQUE FOOTPRINT %lu bytes\n",
+                hclib_get_deque_footprint(NULL));
+    }
+
     if (instrument) {
         finalize_instrumentation();
     }
@@ -1477,3 +2511,132 @@ void hclib_launch(generic_frame_ptr fct_ptr, void *arg, const char **deps,
     }
 }
 
+
+/*
+ * Service mode. Instead of running a single root task under hclib_launch, the
+ * runtime is started once by hclib_service_start and then runs root tasks
+ * submitted from any thread, until hclib_service_stop. In between, workers that
+ * have nothing to do sleep on the idle eventcount.
+ *
+ * The runtime itself runs under hclib_launch on a service thread, whose root
+ * task waits for service_stop to be put. Submitted root tasks are checked in on
+ * the root finish of that launch, so it only ends once all of them completed.
+ */
+static pthread_t service_thread;
+static const char **service_deps = NULL;
+static int service_ndeps = 0;
+static hclib_promise_t *service_stop = NULL;
+static finish_t *volatile service_finish = NULL;
+static pthread_mutex_t service_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t service_started = PTHREAD_COND_INITIALIZER;
+
+// Starts with a shared promise, and is released along with it
+typedef struct {
+    hclib_promise_t done;
+    generic_frame_ptr fp;
+    void *arg;
+} service_task_args;
+
+static void service_root(void *arg) {
+    service_stop = hclib_promise_create();
+
+    pthread_mutex_lock(&service_lock);
+    service_finish = CURRENT_WS_INTERNAL->current_finish;
+    pthread_cond_signal(&service_started);
+    pthread_mutex_unlock(&service_lock);
+
+    hclib_future_wait(hclib_get_future_for_promise(service_stop));
+}
+
+static void *service_main(void *arg) {
+    hclib_launch(service_root, NULL, service_deps, service_ndeps);
+    return NULL;
+}
+
+void hclib_service_start(const char **deps, int ndeps) {
+    HASSERT(hc_context == NULL && "the runtime is already running");
+    service_deps = deps;
+    service_ndeps = ndeps;
+
+    if (pthread_create(&service_thread, NULL, service_main, NULL) != 0) {
+        fprintf(stderr, "Error launching service thread\n");
+        exit(4);
+    }
+
+    pthread_mutex_lock(&service_lock);
+    while (service_finish == NULL) {
+        pthread_cond_wait(&service_started, &service_lock);
+    }
+    pthread_mutex_unlock(&service_lock);
+}
+
+static void service_task(void *arg) {
+    service_task_args *args = (service_task_args *)arg;
+
+    hclib_start_finish();
+    (args->fp)(args->arg);
+    hclib_end_finish();
+
+    hclib_promise_put(&args->done, NULL);
+    hclib_future_release(&args->done.future);
+}
+
+/*
+ * Run fp(arg) at locale in a finish scope of its own, which is checked in on
+ * finish rather than on that of the caller, and return a future satisfied once
+ * the scope ended. The caller owns a reference to it.
+ */
+static hclib_future_t *submit_root_task(finish_t *finish,
+        hclib_locale_t *locale, generic_frame_ptr fp, void *arg) {
+    service_task_args *args = (service_task_args *)hclib_object_alloc(
+            sizeof(*args));
+    hclib_promise_init_shared(&args->done, 2);
+    args->fp = fp;
+    args->arg = arg;
+
+    hclib_task_t *task = hclib_task_alloc(sizeof(*task));
+    task->_fp = service_task;
+    task->args = args;
+    task->locale = locale;
+    check_in_finish(finish);
+    set_current_finish(task, finish);
+    locale_inject_task(locale, task);
+
+    return hclib_get_future_for_promise(&args->done);
+}
+
+hclib_future_t *hclib_service_submit(generic_frame_ptr fp, void *arg) {
+    finish_t *finish = service_finish;
+    HASSERT(finish && "the runtime is not running in service mode");
+    return submit_root_task(finish, NULL, fp, arg);
+}
+
+void hclib_service_run(generic_frame_ptr fp, void *arg) {
+    hclib_future_t *done = hclib_service_submit(fp, arg);
+    hclib_future_wait(done);
+    hclib_future_release(done);
+}
+
+void hclib_service_stop() {
+    HASSERT(service_finish && "the runtime is not running in service mode");
+    HASSERT(CURRENT_WS_INTERNAL == NULL &&
+            "the runtime can't be stopped from one of its own tasks");
+
+    hclib_promise_put(service_stop, NULL);
+    pthread_join(service_thread, NULL);
+
+    free(service_stop);
+    service_stop = NULL;
+    service_finish = NULL;
+}
+
+/*
+ * Run a root task in an arena, see hclib_declare_arena. Its finish scope is
+ * checked in on that of hclib_launch, so the caller does not wait for it at
+ * the end of its own finish scopes.
+ */
+hclib_future_t *hclib_arena_submit(hclib_locale_t *arena, generic_frame_ptr fp,
+        void *arg) {
+    HASSERT(hc_context && arena && arena->is_arena);
+    return submit_root_task(hc_context->root_finish, arena, fp, arg);
+}
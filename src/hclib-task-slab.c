@@ -0,0 +1,235 @@
+/* Copyright (c) 2015, Rice University
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1.  Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+2.  Redistributions in binary form must reproduce the above
+     copyright notice, this list of conditions and the following
+     disclaimer in the documentation and/or other materials provided
+     with the distribution.
+3.  Neither the name of Rice University
+     nor the names of its contributors may be used to endorse or
+     promote products derived from this software without specific
+     prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+/*
+ * hclib-task-slab.c
+ *
+ * Per-worker slab allocation of task objects, see hclib-task-slab.h.
+ */
+
+#include "hclib-internal.h"
+#include "hclib-atomics.h"
+#include "hclib-task-slab.h"
+#include "hclib-async-struct.h"
+
+extern hclib_context *hc_context;
+
+/*
+ * Header preceding each block handed out by hclib_task_alloc. Kept at 16 bytes
+ * so that the task itself stays suitably aligned for any type.
+ */
+struct hclib_task_block_t {
+    // Worker owning the slab this block came from, or -1 if heap allocated
+    int owner;
+    // HCLIB_TASK_POOL or HCLIB_OBJECT_POOL, a block never changes pool
+    int pool;
+    // Link in the free lists, only valid while the block is free
+    hclib_task_block_t *next;
+};
+
+#define BLOCK_PAYLOAD_SIZE (HCLIB_TASK_SLAB_BLOCK_SIZE - \
+        sizeof(hclib_task_block_t))
+HASSERT_STATIC(BLOCK_PAYLOAD_SIZE == HCLIB_TASK_SLAB_PAYLOAD_SIZE,
+        "HCLIB_TASK_SLAB_PAYLOAD_SIZE does not match the slab blocks");
+// Space reserved at the start of each slab to link it into slab->slabs
+#define SLAB_HEADER_SIZE 64
+
+static inline hclib_task_slab_t *get_slab(int pool, int wid) {
+    return (pool == HCLIB_TASK_POOL ? hc_context->task_slabs :
+            hc_context->object_slabs) + wid;
+}
+
+/*
+ * Carve a new slab into blocks and return them as a NULL-terminated list.
+ */
+static hclib_task_block_t *allocate_slab(hclib_task_slab_t *slab,
+        const int pool, const int wid) {
+    int i;
+    char *mem;
+    const int err = posix_memalign((void **)&mem, 64, SLAB_HEADER_SIZE +
+            HCLIB_TASK_SLAB_BLOCKS * HCLIB_TASK_SLAB_BLOCK_SIZE);
+    HASSERT(err == 0 && mem);
+
+    *((void **)mem) = slab->slabs;
+    slab->slabs = mem;
+
+    hclib_task_block_t *head = NULL;
+    for (i = HCLIB_TASK_SLAB_BLOCKS - 1; i >= 0; i--) {
+        hclib_task_block_t *block = (hclib_task_block_t *)(mem +
+                SLAB_HEADER_SIZE + i * HCLIB_TASK_SLAB_BLOCK_SIZE);
+        block->owner = wid;
+        block->pool = pool;
+        block->next = head;
+        head = block;
+    }
+    return head;
+}
+
+/*
+ * Hand a chain of blocks back to the worker that owns them. The owner only
+ * ever takes the whole list at once, so a simple CAS push is safe.
+ */
+static void return_blocks(hclib_task_slab_t *owner, hclib_task_block_t *head,
+        hclib_task_block_t *tail) {
+    hclib_task_block_t *old;
+    do {
+        old = owner->remote_free;
+        tail->next = old;
+    } while (!__sync_bool_compare_and_swap(&owner->remote_free, old, head));
+}
+
+/*
+ * Allocate nbytes of zeroed memory from pool. Called from worker threads this
+ * is served from the worker's slab, otherwise (e.g. before the runtime has been
+ * initialized) or for large requests it falls back to the system allocator.
+ */
+static void *pool_alloc(const int pool, size_t nbytes) {
+    hclib_task_block_t *block;
+    hclib_worker_state *ws = (hc_context ? CURRENT_WS_INTERNAL : NULL);
+
+    if (ws == NULL || nbytes > BLOCK_PAYLOAD_SIZE) {
+        block = (hclib_task_block_t *)malloc(sizeof(*block) + nbytes);
+        HASSERT(block);
+        block->owner = -1;
+        block->pool = pool;
+    } else {
+        hclib_task_slab_t *slab = get_slab(pool, ws->id);
+        block = slab->local_free;
+        if (block == NULL) {
+            // Reclaim anything other workers have returned to us
+            block = __sync_lock_test_and_set(&slab->remote_free, NULL);
+            if (block == NULL) {
+                block = allocate_slab(slab, pool, ws->id);
+            }
+        }
+        slab->local_free = block->next;
+    }
+
+    void *mem = (void *)(block + 1);
+    memset(mem, 0x00, nbytes);
+    return mem;
+}
+
+/*
+ * Give back memory from either pool, the block header tells which.
+ */
+static void pool_free(void *mem) {
+    hclib_task_block_t *block = ((hclib_task_block_t *)mem) - 1;
+    const int owner = block->owner;
+    const int pool = block->pool;
+
+    if (owner < 0) {
+        free(block);
+        return;
+    }
+
+    hclib_worker_state *ws = CURRENT_WS_INTERNAL;
+    if (ws == NULL) {
+        return_blocks(get_slab(pool, owner), block, block);
+    } else if (ws->id == owner) {
+        hclib_task_slab_t *slab = get_slab(pool, owner);
+        block->next = slab->local_free;
+        slab->local_free = block;
+    } else {
+        /*
+         * Freeing a task that was stolen from another worker. Buffer it
+         * locally and only return it once we have a full batch, to amortize
+         * the atomic operation and the cache line transfer.
+         */
+        hclib_task_remote_batch_t *batch = get_slab(pool, ws->id)->pending +
+            owner;
+        block->next = batch->head;
+        if (batch->head == NULL) {
+            batch->tail = block;
+        }
+        batch->head = block;
+
+        if (++batch->count == HCLIB_TASK_SLAB_REMOTE_BATCH) {
+            return_blocks(get_slab(pool, owner), batch->head, batch->tail);
+            batch->head = batch->tail = NULL;
+            batch->count = 0;
+        }
+    }
+}
+
+void *hclib_task_alloc(size_t nbytes) {
+    return pool_alloc(HCLIB_TASK_POOL, nbytes);
+}
+
+void hclib_task_free(void *task) {
+    pool_free(task);
+}
+
+int hclib_task_in_slab(void *task) {
+    hclib_task_block_t *block = ((hclib_task_block_t *)task) - 1;
+    return block->owner >= 0 && block->pool == HCLIB_TASK_POOL;
+}
+
+void *hclib_object_alloc(size_t nbytes) {
+    return pool_alloc(HCLIB_OBJECT_POOL, nbytes);
+}
+
+void hclib_object_free(void *object) {
+    pool_free(object);
+}
+
+hclib_task_slab_t *hclib_task_slabs_create(int nworkers) {
+    int i;
+    hclib_task_slab_t *slabs;
+    const int err = posix_memalign((void **)&slabs, 64,
+            nworkers * sizeof(*slabs));
+    HASSERT(err == 0 && slabs);
+    memset(slabs, 0x00, nworkers * sizeof(*slabs));
+
+    for (i = 0; i < nworkers; i++) {
+        slabs[i].pending = (hclib_task_remote_batch_t *)calloc(nworkers,
+                sizeof(hclib_task_remote_batch_t));
+        HASSERT(slabs[i].pending);
+    }
+    return slabs;
+}
+
+/*
+ * Release all slabs. Any tasks still allocated from them become invalid.
+ */
+void hclib_task_slabs_destroy(hclib_task_slab_t *slabs, int nworkers) {
+    int i;
+    for (i = 0; i < nworkers; i++) {
+        void *mem = slabs[i].slabs;
+        while (mem) {
+            void *next = *((void **)mem);
+            free(mem);
+            mem = next;
+        }
+        free(slabs[i].pending);
+    }
+    free(slabs);
+}
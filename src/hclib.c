@@ -24,6 +24,13 @@ unsigned hclib_register_dist_func(loop_dist_func func) {
     return n_registered_dist_funcs - 1;
 }
 
+// Forget all registered functions, when the runtime shuts down
+void hclib_release_dist_funcs() {
+    free(registered_dist_funcs);
+    registered_dist_funcs = NULL;
+    n_registered_dist_funcs = 0;
+}
+
 loop_dist_func hclib_lookup_dist_func(unsigned id) {
     HASSERT(id < n_registered_dist_funcs);
     return registered_dist_funcs[id];
@@ -33,8 +40,7 @@ loop_dist_func hclib_lookup_dist_func(unsigned id) {
 
 void hclib_async(generic_frame_ptr fp, void *arg, hclib_future_t **futures,
         const int nfutures, hclib_locale_t *locale) {
-    hclib_task_t *task = calloc(1, sizeof(*task));
-    HASSERT(task);
+    hclib_task_t *task = hclib_task_alloc(sizeof(*task));
 
     task->_fp = fp;
     task->args = arg;
@@ -48,8 +54,25 @@ void hclib_async(generic_frame_ptr fp, void *arg, hclib_future_t **futures,
     }
 }
 
+void hclib_async_with_priority(generic_frame_ptr fp, void *arg,
+        hclib_future_t **futures, const int nfutures,
+        hclib_locale_t *locale, const int priority) {
+    assert(priority >= HCLIB_PRIORITY_DEFAULT && priority <= HCLIB_PRIORITY_MAX);
+    hclib_task_t *task = hclib_task_alloc(sizeof(*task));
+
+    task->_fp = fp;
+    task->args = arg;
+    task->priority = priority;
+
+    if (nfutures > 0) {
+        spawn_await_at(task, futures, nfutures, locale);
+    } else {
+        spawn_at(task, locale);
+    }
+}
+
 void hclib_async_nb(generic_frame_ptr fp, void *arg, hclib_locale_t *locale) {
-    hclib_task_t *task = calloc(1, sizeof(*task));
+    hclib_task_t *task = hclib_task_alloc(sizeof(*task));
     task->_fp = fp;
     task->args = arg;
     task->non_blocking = 1;
@@ -62,20 +85,52 @@ typedef struct _future_args_wrapper {
     void *actual_in;
 } future_args_wrapper;
 
+/*
+ * The wrapper starts with a shared promise, so it is released along with it
+ * once the caller is done with the future and we have put on it.
+ */
+static future_args_wrapper *create_future_args_wrapper() {
+    future_args_wrapper *wrapper = hclib_object_alloc(sizeof(*wrapper));
+    hclib_promise_init_shared(&wrapper->event, 2);
+    return wrapper;
+}
+
 static void future_caller(void *in) {
     future_args_wrapper *args = in;
     void *user_result = (args->fp)(args->actual_in);
     hclib_promise_put(&args->event, user_result);
+    hclib_future_release(&args->event.future);
 }
 
 hclib_future_t *hclib_async_future(future_fct_t fp, void *arg,
                                    hclib_future_t **futures, const int nfutures,
                                    hclib_locale_t *locale) {
-    future_args_wrapper *wrapper = malloc(sizeof(future_args_wrapper));
-    hclib_promise_init(&wrapper->event);
+    future_args_wrapper *wrapper = create_future_args_wrapper();
     wrapper->fp = fp;
     wrapper->actual_in = arg;
-    hclib_async(future_caller, wrapper, futures, nfutures, locale);
+    if (nfutures > 0) {
+        hclib_async(future_caller, wrapper, futures, nfutures, locale);
+    } else {
+        hclib_task_t *task = hclib_task_alloc(sizeof(*task));
+        task->_fp = future_caller;
+        task->args = wrapper;
+        hclib_task_set_producer(task, &wrapper->event);
+        spawn_at(task, locale);
+    }
+
+    return hclib_get_future_for_promise(&wrapper->event);
+}
+
+hclib_future_t *hclib_submit(future_fct_t fp, void *arg,
+        hclib_locale_t *locale) {
+    future_args_wrapper *wrapper = create_future_args_wrapper();
+    wrapper->fp = fp;
+    wrapper->actual_in = arg;
+
+    hclib_task_t *task = hclib_task_alloc(sizeof(*task));
+    task->_fp = future_caller;
+    task->args = wrapper;
+    locale_inject_task(locale, task);
 
     return hclib_get_future_for_promise(&wrapper->event);
 }
@@ -87,23 +142,20 @@ hclib_future_t *hclib_async_future(future_fct_t fp, void *arg,
 #define DEBUG_FORASYNC 0
 
 static inline forasync1D_task_t *allocate_forasync1D_task() {
-    forasync1D_task_t *forasync_task = (forasync1D_task_t *)calloc(1,
+    forasync1D_task_t *forasync_task = (forasync1D_task_t *)hclib_task_alloc(
             sizeof(*forasync_task));
-    HASSERT(forasync_task && "malloc failed");
     return forasync_task;
 }
 
 static inline forasync2D_task_t *allocate_forasync2D_task() {
-    forasync2D_task_t *forasync_task = (forasync2D_task_t *)calloc(1,
+    forasync2D_task_t *forasync_task = (forasync2D_task_t *)hclib_task_alloc(
             sizeof(*forasync_task));
-    HASSERT(forasync_task && "malloc failed");
     return forasync_task;
 }
 
 static inline forasync3D_task_t *allocate_forasync3D_task() {
-    forasync3D_task_t *forasync_task = (forasync3D_task_t *)calloc(1,
+    forasync3D_task_t *forasync_task = (forasync3D_task_t *)hclib_task_alloc(
             sizeof(*forasync_task));
-    HASSERT(forasync_task && "malloc failed");
     return forasync_task;
 }
 
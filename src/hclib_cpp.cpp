@@ -1,10 +1,6 @@
 #include "hclib_cpp.h"
 #include "hclib_future.h"
 
-hclib_worker_state *hclib::current_ws() {
-    return CURRENT_WS_INTERNAL;
-}
-
 int hclib::get_current_worker() {
     return hclib_get_current_worker();
 }
@@ -13,6 +9,14 @@ int hclib::get_num_workers() {
     return hclib_get_num_workers();
 }
 
+int hclib::get_num_active_workers() {
+    return hclib_get_num_active_workers();
+}
+
+void hclib::set_num_active_workers(int n) {
+    hclib_set_num_active_workers(n);
+}
+
 int hclib::get_num_locales() {
     return hclib_get_num_locales();
 }
@@ -163,6 +163,21 @@ void hclib_release_per_worker_module_state(const unsigned state_id,
     }
 }
 
+/*
+ * Called on shutdown, once every module has released its part of the per-worker
+ * state, so that the next initialization of the runtime starts from scratch.
+ */
+void hclib_free_per_worker_module_state() {
+    int i;
+
+    for (i = 0; i < hc_context->nworkers; i++) {
+        hclib_worker_state *ws = hc_context->workers[i];
+        free(ws->module_state);
+        ws->module_state = NULL;
+    }
+    worker_state_size = 0;
+}
+
 #ifdef __cplusplus
 }
 #endif
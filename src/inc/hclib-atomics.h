@@ -59,6 +59,17 @@ static __inline__ void hc_mfence() {
     __sync_synchronize();
 }
 
+/*
+ * Hint to the processor that we are busy-waiting.
+ */
+static __inline__ void hc_cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#else
+    __asm__ __volatile__("" ::: "memory");
+#endif
+}
+
 /*
  * if (*ptr == ag) { *ptr = x, return 1 }
  * else return 0;
@@ -39,17 +39,54 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef HCLIB_DEQUE_H_
 #define HCLIB_DEQUE_H_
 
+#include <stdatomic.h>
+
 #include "hclib-task.h"
 
 /****************************************************/
 /* DEQUE API                                        */
 /****************************************************/
 
-#define STEAL_CHUNK_SIZE 1
+/*
+ * Upper bound on the number of tasks taken by a single steal. The number
+ * actually taken is also bounded by the steal_batch of the locale being stolen
+ * from and by half of the victim's deque.
+ */
+#define STEAL_CHUNK_SIZE 32
+
+/*
+ * Default steal_batch for each locale, can be overridden with the
+ * HCLIB_STEAL_BATCH environment variable or hclib_locale_set_steal_batch.
+ */
+#define DEFAULT_STEAL_BATCH 8
+
+/*
+ * Initial number of slots in each deque's circular buffer. Must be a power of
+ * two. Deques grow on demand by doubling, so this only needs to cover the
+ * common case.
+ */
+#define INIT_DEQUE_CAPACITY 256
+
+#define HCLIB_CACHE_LINE 64
 
-// #define INIT_DEQUE_CAPACITY 16384
-#define INIT_DEQUE_CAPACITY 1048576
+/*
+ * A circular buffer of task slots. When a deque fills up, its owner allocates
+ * a buffer of twice the capacity, copies the live entries over, and publishes
+ * it. Thieves may still be reading from the old buffer at that point, so
+ * retired buffers are chained through prev and only freed when the deque is
+ * destroyed. Since capacity doubles, retired buffers never take more space
+ * than the live one.
+ */
+typedef struct hclib_deque_buffer_t {
+    long capacity;
+    struct hclib_deque_buffer_t *prev;
+    _Atomic(hclib_task_t *) data[];
+} hclib_deque_buffer_t;
 
+/*
+ * A Chase-Lev work-stealing deque, using the C11 memory orderings described in
+ * Le et al. "Correct and Efficient Work-Stealing for Weak Memory Models".
+ */
 typedef struct hclib_internal_deque_t {
     /*
      * Head is shared by all threads, both stealers and the thread local to this
@@ -57,24 +94,38 @@ typedef struct hclib_internal_deque_t {
      * Stealing a task implies reading the task pointed to by head and then
      * safely incrementing head.
      */
-    volatile int head;
+    _Atomic long head __attribute__((aligned(HCLIB_CACHE_LINE)));
 
     /*
      * Tail is only manipulated by the thread owning a deque. New tasks are
      * pushed into the slot pointed to by tail, followed by an increment of
      * tail. Local tasks may be acquired by decrementing tail and grabbing the
-     * task at the slot pointed to post-decrement.
+     * task at the slot pointed to post-decrement. Kept on a separate cache line
+     * from head so that thieves polling head do not interfere with the owner.
      */
-    volatile int tail;
+    _Atomic long tail __attribute__((aligned(HCLIB_CACHE_LINE)));
 
-    volatile hclib_task_t* data[INIT_DEQUE_CAPACITY];
-} hclib_internal_deque_t;
+    /*
+     * NULL until the first push to this deque. Only the owner ever replaces
+     * the buffer.
+     */
+    _Atomic(hclib_deque_buffer_t *) buffer;
+} __attribute__((aligned(HCLIB_CACHE_LINE))) hclib_internal_deque_t;
 
 void deque_init(hclib_internal_deque_t *deq, void *initValue);
 int deque_push(hclib_internal_deque_t *deq, void *entry);
+void deque_push_batch(hclib_internal_deque_t *deq, void **entries, int n);
 hclib_task_t* deque_pop(hclib_internal_deque_t *deq);
-int deque_steal(hclib_internal_deque_t *deq, void **stolen);
+int deque_steal(hclib_internal_deque_t *deq, void **stolen, int max_steal);
+void deque_push_private(hclib_internal_deque_t *deq, void *entry);
+void deque_push_batch_private(hclib_internal_deque_t *deq, void **entries,
+        int n);
+hclib_task_t* deque_pop_private(hclib_internal_deque_t *deq);
+int deque_take_private(hclib_internal_deque_t *deq, void **stolen,
+        int max_steal);
 void deque_destroy(hclib_internal_deque_t *deq);
 unsigned deque_size(hclib_internal_deque_t *deq);
+unsigned deque_capacity(hclib_internal_deque_t *deq);
+size_t deque_footprint(hclib_internal_deque_t *deq);
 
 #endif /* HCLIB_DEQUE_H_ */
@@ -0,0 +1,110 @@
+/* Copyright (c) 2015, Rice University
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1.  Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+2.  Redistributions in binary form must reproduce the above
+     copyright notice, this list of conditions and the following
+     disclaimer in the documentation and/or other materials provided
+     with the distribution.
+3.  Neither the name of Rice University
+     nor the names of its contributors may be used to endorse or
+     promote products derived from this software without specific
+     prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+/*
+ * hclib-eventcount.h
+ *
+ * An eventcount lets idle workers sleep until new work or the event they are
+ * blocked on shows up, without making the threads producing work take a lock.
+ * A worker announces itself with hclib_ec_prepare_wait, re-checks for work,
+ * and then either cancels or sleeps until the epoch moves past the value it
+ * was handed. Producers bump the epoch and wake sleepers only when there are
+ * any, so the common case costs a fence and a load.
+ */
+
+#ifndef HCLIB_EVENTCOUNT_H_
+#define HCLIB_EVENTCOUNT_H_
+
+#include <stdatomic.h>
+
+#ifndef __linux__
+#include <pthread.h>
+#endif
+
+typedef struct hclib_eventcount_t {
+    // Bumped on every wakeup, sleepers wait for it to change
+    _Atomic unsigned epoch;
+    // Number of workers between prepare_wait and the end of wait/cancel
+    _Atomic int nsleepers;
+    /*
+     * Of those, how many are waiting for a specific finish scope or future to
+     * be satisfied (rather than just for new work).
+     */
+    _Atomic int nflag_sleepers;
+#ifndef __linux__
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+#endif
+} __attribute__((aligned(64))) hclib_eventcount_t;
+
+void hclib_ec_init(hclib_eventcount_t *ec);
+void hclib_ec_destroy(hclib_eventcount_t *ec);
+void hclib_ec_wait(hclib_eventcount_t *ec, unsigned key, int on_flag);
+void hclib_ec_wake(hclib_eventcount_t *ec, int nwake);
+
+static inline unsigned hclib_ec_prepare_wait(hclib_eventcount_t *ec,
+        int on_flag) {
+    atomic_fetch_add(&ec->nsleepers, 1);
+    if (on_flag) {
+        atomic_fetch_add(&ec->nflag_sleepers, 1);
+    }
+    return atomic_load(&ec->epoch);
+}
+
+static inline void hclib_ec_cancel_wait(hclib_eventcount_t *ec, int on_flag) {
+    if (on_flag) {
+        atomic_fetch_sub(&ec->nflag_sleepers, 1);
+    }
+    atomic_fetch_sub(&ec->nsleepers, 1);
+}
+
+/*
+ * Called after making new work available, wakes up to nwake sleeping workers.
+ */
+static inline void hclib_ec_notify(hclib_eventcount_t *ec, int nwake) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&ec->nsleepers, memory_order_relaxed) > 0) {
+        hclib_ec_wake(ec, nwake);
+    }
+}
+
+/*
+ * Called after satisfying something a worker may be blocked on. We do not know
+ * which sleeper that is, so all of them are woken up.
+ */
+static inline void hclib_ec_notify_flag(hclib_eventcount_t *ec) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&ec->nflag_sleepers, memory_order_relaxed) > 0) {
+        hclib_ec_wake(ec, -1);
+    }
+}
+
+#endif /* HCLIB_EVENTCOUNT_H_ */
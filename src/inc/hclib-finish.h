@@ -7,6 +7,10 @@ typedef struct finish_t {
     struct finish_t* parent;
     volatile int counter;
     hclib_future_t *finish_dep;
+    // Backs finish_dep when the end of this finish is waited on by a continuation
+    hclib_promise_t promise;
+    // Next finish in the per-worker pool of recycled finish scopes
+    struct finish_t *pool_next;
 } finish_t;
 
 #endif
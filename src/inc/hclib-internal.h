@@ -46,6 +46,8 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "hclib.h"
 #include "litectx.h"
 #include "hclib-locality-graph.h"
+#include "hclib-task-slab.h"
+#include "hclib-eventcount.h"
 
 #define LOG_LEVEL_FATAL         1
 #define LOG_LEVEL_WARN          2
@@ -73,6 +75,95 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #define CACHE_LINE_L1 8
 
+// Default for HCLIB_SPIN_BEFORE_PARK
+#ifndef HCLIB_DEFAULT_SPIN_BEFORE_PARK
+#define HCLIB_DEFAULT_SPIN_BEFORE_PARK 256
+#endif
+
+// Max number of idle lite contexts each worker keeps around for reuse
+#ifndef HCLIB_CTX_POOL_SIZE
+#define HCLIB_CTX_POOL_SIZE 8
+#endif
+
+/*
+ * Max number of lite contexts alive at once with a guard page below their
+ * stack. Each costs two memory mappings, and the default vm.max_map_count is
+ * 65530, so past this contexts go without one rather than run out.
+ */
+#ifndef HCLIB_MAX_GUARDED_CTXS
+#define HCLIB_MAX_GUARDED_CTXS 8192
+#endif
+
+// Max number of finish scopes each worker keeps around for reuse
+#ifndef HCLIB_FINISH_POOL_SIZE
+#define HCLIB_FINISH_POOL_SIZE 64
+#endif
+
+/*
+ * In private deque mode, how many times a thief polls for an answer from a
+ * victim before withdrawing its request. The victim only answers between
+ * tasks, so this bounds how long a thief stays stuck behind a long one.
+ */
+#ifndef HCLIB_STEAL_REQUEST_PATIENCE
+#define HCLIB_STEAL_REQUEST_PATIENCE 4096
+#endif
+
+/*
+ * Size of each worker's ring of latent tasks in heartbeat mode, a power of two.
+ * Once it fills up, the oldest half is promoted.
+ */
+#ifndef HCLIB_LATENT_TASKS
+#define HCLIB_LATENT_TASKS 64
+#endif
+
+/*
+ * In heartbeat mode, workers only look at the clock once every this many spawns
+ * and pops of latent tasks, a power of two.
+ */
+#ifndef HCLIB_HEARTBEAT_POLL
+#define HCLIB_HEARTBEAT_POLL 32
+#endif
+
+/*
+ * After this many tasks in a row from the higher priority lanes of its deques,
+ * a worker gives the default lane a turn, so it is not starved.
+ */
+#ifndef HCLIB_PRIORITY_BURST
+#define HCLIB_PRIORITY_BURST 16
+#endif
+
+/*
+ * In work-first mode, how deep a chain of tasks suspended at their spawns may
+ * grow before spawns fall back to help-first. Each of them holds on to a
+ * context, so this bounds the number of stacks a worker keeps alive. Workers
+ * also keep this many idle contexts around in that mode, since they go through
+ * a context per spawn.
+ */
+#ifndef HCLIB_WORK_FIRST_MAX_DEPTH
+#define HCLIB_WORK_FIRST_MAX_DEPTH 128
+#endif
+
+/*
+ * With the load-based controller on, how often a worker checks whether to
+ * reactivate a retired worker, in tasks (a power of two), and how many tasks
+ * must be queued on it for that.
+ */
+#ifndef HCLIB_ELASTIC_POLL
+#define HCLIB_ELASTIC_POLL 64
+#endif
+#ifndef HCLIB_ELASTIC_GROW_BACKLOG
+#define HCLIB_ELASTIC_GROW_BACKLOG 8
+#endif
+
+// Value of steal_response while a steal request has not been answered yet
+#define STEAL_RESPONSE_PENDING (-1)
+
+/*
+ * Value of producer_claim while a waiter checks that the task it is about to
+ * claim still is the producer it was looking for
+ */
+#define PRODUCER_CLAIM_TENTATIVE (-1)
+
 // Default value of a promise datum
 #define UNINITIALIZED_PROMISE_DATA_PTR NULL
 
@@ -98,30 +189,206 @@ typedef struct hclib_context {
     /* a simple implementation of wait/wakeup condition */
     volatile int workers_wait_cond;
     worker_done_t *done_flags;
+    /* per-worker allocators for task objects */
+    hclib_task_slab_t *task_slabs;
+    /* and for other runtime objects, see hclib_object_alloc */
+    hclib_task_slab_t *object_slabs;
+    /* bytes reserved for each lite context, see HCLIB_STACK_SIZE */
+    size_t ctx_stack_size;
+    /* max number of idle lite contexts each worker keeps around */
+    int ctx_pool_max;
+    /* number of lite contexts with a guard page, see HCLIB_MAX_GUARDED_CTXS */
+    volatile int guarded_ctxs;
+    /* where workers that ran out of work sleep */
+    hclib_eventcount_t *idle_ec;
+    /*
+     * number of failed steal attempts before an idle worker goes to sleep, or
+     * negative to never sleep. See HCLIB_SPIN_BEFORE_PARK.
+     */
+    int spin_before_park;
+    /*
+     * whether workers keep their tasks in private deques and hand them to
+     * thieves on request, see HCLIB_PRIVATE_DEQUES
+     */
+    int private_deques;
+    /*
+     * nanoseconds between promotions of latent tasks, or 0 if tasks are always
+     * made visible to thieves when spawned. See HCLIB_HEARTBEAT_US.
+     */
+    unsigned long long heartbeat_ns;
+    /*
+     * whether spawning a task runs it right away and leaves the continuation
+     * of its parent to thieves, see HCLIB_WORK_FIRST
+     */
+    int work_first;
+    /*
+     * whether tasks awaiting several futures register on all of them at once
+     * and count them down, see HCLIB_DEPENDENCY_COUNTING
+     */
+    int dependency_counting;
+    /*
+     * workers with an ID of nactive or more retire, see
+     * hclib_set_num_active_workers. The load-based controller keeps nactive at
+     * or below max_active.
+     */
+    volatile int nactive;
+    int max_active;
+    /*
+     * nanoseconds a worker may go without finding work before the load-based
+     * controller retires it, or 0 if it is off. See HCLIB_ELASTIC_IDLE_US.
+     */
+    unsigned long long elastic_idle_ns;
+    /* where retired workers sleep */
+    hclib_eventcount_t *retired_ec;
+    /* cached result of hclib_get_central_place, NULL until first asked for */
+    hclib_locale_t *central_place;
+    /* finish scope of hclib_launch, which root tasks submitted later join */
+    struct finish_t *root_finish;
 #ifdef HC_CUDA
     hclib_memory_tree_node *pinned_host_allocs;
     cudaStream_t stream;
 #endif
 } hclib_context;
 
+extern hclib_context *hc_context;
+
+// Whether some worker that is not retired steals from locale
+static inline int locale_has_active_thief(hclib_locale_t *locale) {
+    return locale->first_thief < hc_context->nactive;
+}
+
+/*
+ * Wake up sleeping workers after pushing ntasks tasks at locale. We cannot
+ * pick which sleepers get woken, so unless every worker may steal from this
+ * locale all of them are. Retired workers are woken up too if they are the
+ * only ones left to take these tasks.
+ */
+static inline void notify_tasks_at(hclib_locale_t *locale, int ntasks) {
+    if (locale->n_thieves == hc_context->nworkers) {
+        hclib_ec_notify(hc_context->idle_ec, ntasks);
+    } else {
+        hclib_ec_notify(hc_context->idle_ec, -1);
+        if (!locale_has_active_thief(locale)) {
+            hclib_ec_notify(hc_context->retired_ec, -1);
+        }
+    }
+}
+
+/*
+ * Where tasks spawned on ws without a locale go: the arena of ws if it is part
+ * of one, or else locale 0.
+ */
+static inline hclib_locale_t *default_spawn_locale(hclib_worker_state *ws) {
+    hclib_locale_t *arena = ws->paths->arena;
+    return arena ? arena : hc_context->graph->locales + 0;
+}
+
 #include "hclib-finish.h"
 
 typedef struct _hclib_deque_t {
     /* The actual deque, WARNING: do not move declaration !
-     * Other parts of the runtime rely on it being the first one. */
+     * Other parts of the runtime rely on it being the first one.
+     * Holds the tasks of HCLIB_PRIORITY_DEFAULT. */
     hclib_internal_deque_t deque;
+    /*
+     * Lanes for tasks of priority 1 to HCLIB_PRIORITY_MAX. Like any deque
+     * they only get a buffer once something is pushed to them.
+     */
+    hclib_internal_deque_t prio_lanes[HCLIB_NUM_PRIORITIES - 1];
     struct _hclib_worker_state * ws;
     struct _hclib_deque_t *nnext;
     struct _hclib_deque_t *prev; /* the deque list of the worker */
     hclib_locale_t *locale;
+    /*
+     * Set in private deque mode if this deque is on its owner's pop path.
+     * Only its owner accesses it then, see HCLIB_PRIVATE_DEQUES.
+     */
+    int is_private;
 } hclib_deque_t;
 
+static inline hclib_internal_deque_t *deque_lane(hclib_deque_t *deq,
+        int priority) {
+    return priority == HCLIB_PRIORITY_DEFAULT ? &deq->deque :
+        deq->prio_lanes + priority - 1;
+}
+
+// Number of tasks in all lanes of deq
+static inline unsigned hclib_deque_size(hclib_deque_t *deq) {
+    unsigned size = deque_size(&deq->deque);
+    int i;
+    for (i = 0; i < HCLIB_NUM_PRIORITIES - 1; i++) {
+        size += deque_size(deq->prio_lanes + i);
+    }
+    return size;
+}
+
 void log_(const char * file, int line, hclib_worker_state * ws, const char * format,
         ...);
 
 // promise
 int register_on_all_promise_dependencies(hclib_task_t *wrapper_task);
-void try_schedule_async(hclib_task_t * async_task, hclib_worker_state *ws);
+void schedule_released_tasks(hclib_task_t **tasks, int n,
+        hclib_worker_state *ws);
+
+// loop distribution functions
+void hclib_release_dist_funcs();
+
+// finish
+void transfer_deferred_checkins(hclib_task_t **tasks, int ntasks);
+
+// private deques
+int release_ran_inline(hclib_task_t **tasks, int ntasks);
+void answer_steal_request_slow(hclib_worker_state *ws);
+
+/*
+ * In private deque mode, called by a worker at points where it can hand tasks
+ * to a thief waiting on it. Just a load when nobody is.
+ */
+static inline void answer_steal_request(hclib_worker_state *ws) {
+    if (ws->steal_request > 0) {
+        answer_steal_request_slow(ws);
+    }
+}
+
+// heartbeat mode
+void poll_latent_tasks(hclib_worker_state *ws);
+
+static inline int latent_tasks_need_poll(hclib_worker_state *ws) {
+    return ws->latent_wanted ||
+        (++ws->latent_polls & (HCLIB_HEARTBEAT_POLL - 1)) == 0;
+}
+
+/*
+ * Spawning a task in heartbeat mode only records it on the spawning worker,
+ * without any synchronization. It is only pushed to a deque (promoted) if a
+ * thief asks for it, at the next heartbeat, or if the ring is full.
+ */
+static inline void push_latent_task(hclib_worker_state *ws,
+        hclib_task_t *task) {
+    if (ws->latent_tail - ws->latent_head == HCLIB_LATENT_TASKS) {
+        poll_latent_tasks(ws);
+    }
+    ws->latent_tasks[ws->latent_tail++ & (HCLIB_LATENT_TASKS - 1)] = task;
+    if (latent_tasks_need_poll(ws)) {
+        poll_latent_tasks(ws);
+    }
+}
+
+/*
+ * Newest latent task of this worker, if any. Polls after taking it, so that
+ * we do not hand the task we are about to run to a thief.
+ */
+static inline hclib_task_t *pop_latent_task(hclib_worker_state *ws) {
+    if (ws->latent_tail == ws->latent_head) {
+        return NULL;
+    }
+    hclib_task_t *task = ws->latent_tasks[--ws->latent_tail &
+        (HCLIB_LATENT_TASKS - 1)];
+    if (latent_tasks_need_poll(ws)) {
+        poll_latent_tasks(ws);
+    }
+    return task;
+}
 
 int static inline _hclib_promise_is_satisfied(hclib_promise_t *p) {
     return p->wait_list_head == SATISFIED_FUTURE_WAITLIST_PTR;
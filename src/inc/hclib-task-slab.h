@@ -0,0 +1,98 @@
+/* Copyright (c) 2015, Rice University
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1.  Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+2.  Redistributions in binary form must reproduce the above
+     copyright notice, this list of conditions and the following
+     disclaimer in the documentation and/or other materials provided
+     with the distribution.
+3.  Neither the name of Rice University
+     nor the names of its contributors may be used to endorse or
+     promote products derived from this software without specific
+     prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+/*
+ * hclib-task-slab.h
+ *
+ * Per-worker allocator for task objects. Each worker carves fixed-size,
+ * cache-line aligned blocks out of slabs it owns and recycles them through a
+ * local free list. Blocks freed by a worker other than their owner are batched
+ * up and handed back to the owner in a single atomic operation.
+ *
+ * Runtime objects that are not tasks (shared promises, dependency sets) come
+ * from a second set of slabs with the same layout, so that a block handed out
+ * as a task is only ever reused as a task.
+ */
+
+#ifndef HCLIB_TASK_SLAB_H_
+#define HCLIB_TASK_SLAB_H_
+
+#include <stddef.h>
+
+/*
+ * Size of each block, including its header. Requests that do not fit are
+ * served from the system allocator.
+ */
+#define HCLIB_TASK_SLAB_BLOCK_SIZE 256
+// Number of blocks carved out of each slab
+#define HCLIB_TASK_SLAB_BLOCKS 64
+// Number of remotely freed blocks buffered before returning them to the owner
+#define HCLIB_TASK_SLAB_REMOTE_BATCH 32
+
+// Pools blocks are taken from, see hclib_task_alloc and hclib_object_alloc
+#define HCLIB_TASK_POOL 0
+#define HCLIB_OBJECT_POOL 1
+
+typedef struct hclib_task_block_t hclib_task_block_t;
+
+/*
+ * A batch of blocks freed on this worker but owned by another, waiting to be
+ * returned to their owner.
+ */
+typedef struct hclib_task_remote_batch_t {
+    hclib_task_block_t *head;
+    hclib_task_block_t *tail;
+    int count;
+} hclib_task_remote_batch_t;
+
+typedef struct hclib_task_slab_t {
+    // Only touched by the owning worker
+    hclib_task_block_t *local_free;
+    void *slabs;
+    hclib_task_remote_batch_t *pending;
+
+    /*
+     * Blocks returned by other workers. Kept on its own cache line as it is
+     * the only field written by other threads.
+     */
+    hclib_task_block_t *volatile remote_free __attribute__((aligned(64)));
+} __attribute__((aligned(64))) hclib_task_slab_t;
+
+hclib_task_slab_t *hclib_task_slabs_create(int nworkers);
+void hclib_task_slabs_destroy(hclib_task_slab_t *slabs, int nworkers);
+
+/*
+ * Whether task was allocated from a task slab. The memory of such tasks is
+ * only ever reused for other tasks until the runtime shuts down.
+ */
+int hclib_task_in_slab(void *task);
+
+#endif /* HCLIB_TASK_SLAB_H_ */
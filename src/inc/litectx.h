@@ -14,96 +14,129 @@
 #include "hclib_common.h"
 #include "fcontext.h"
 #include <string.h>
+#include <stdint.h>
+#include <unistd.h>
 
 #ifdef HAVE_SYS_MMAN_H
 #include <sys/mman.h>
 #endif
 
-// #define OVERFLOW_PROTECT
+#if defined(MAP_ANONYMOUS) && !defined(MAP_ANON)
+#define MAP_ANON MAP_ANONYMOUS
+#endif
 
-#define LITECTX_FREE(ptr) free(ptr)
+/*
+ * Default size of the region backing a lite context, including its stack and
+ * the LiteCtx header. The runtime lets users override this with
+ * HCLIB_STACK_SIZE.
+ */
 #define LITECTX_SIZE 0x40000 /* 256KB */
 // #define LITECTX_SIZE 0x10000 /* 64KB */
 
-#ifdef OVERFLOW_PROTECT
-// This must be a multiple of the page size on this machine?
-#define OVERFLOW_PADDING_SIZE 4096LU
-#endif
-
 typedef struct LiteCtxStruct {
-    /*
-     * If we're running in a mode where we want to make a best effort to detect
-     * stack overflows by threads running on lightweight contexts, we create a
-     * small buffer in front of the light context data structures and mprotect
-     * it to PROT_NONE. This adds some overhead to context creation, but can be
-     * useful for debugging odd behavior in HClib programs.
-     */
-#ifdef OVERFLOW_PROTECT
-    char overflow_buffer[OVERFLOW_PADDING_SIZE];
-#endif
     struct LiteCtxStruct *volatile prev;
     void *volatile arg1;
     void *volatile arg2;
     fcontext_t _fctx;
-    char _stack[];
+    /*
+     * Lowest usable address of this context's stack and its size in bytes.
+     * The stack grows down from _stack + _stack_size, which is where this
+     * header lives. Both are zero for proxy contexts.
+     */
+    char *_stack;
+    size_t _stack_size;
+    /*
+     * Region this context was carved out of. When mmap is available, the
+     * lowest page of the region may be mapped PROT_NONE so that a stack
+     * overflow faults instead of silently corrupting neighboring memory.
+     */
+    void *_region;
+    size_t _region_size;
+    // Whether _region was mapped with such a guard page, or came from malloc
+    int _guarded;
+    // Link used by the runtime to keep idle contexts around for reuse.
+    struct LiteCtxStruct *pool_next;
 } LiteCtx;
 
-#define LITECTX_STACK_SIZE ((LITECTX_SIZE) - sizeof(LiteCtx))
-
-#ifdef OVERFLOW_PROTECT
-
-extern int posix_memalign(void **memptr, size_t alignment, size_t size);
-
-static inline void *LITECTX_ALLOC(size_t nbytes) {
-    assert(nbytes == sizeof(LiteCtx) || nbytes == LITECTX_SIZE);
-
-    void *ptr;
-    const int err = posix_memalign(&ptr, (size_t)4096, nbytes);
-    if (err != 0) {
-        fprintf(stderr, "Error in posix_memalign\n");
-        exit(1);
-    }
-
+/*
+ * Allocate a lite context whose region spans at least nbytes, plus a guard
+ * page if guard is set and mmap is available. The stack of the returned
+ * context is not yet set up to run anything, see LiteCtx_init. A context may
+ * be re-initialized any number of times.
+ *
+ * Each guard page splits its mapping in two, and a process may only have so
+ * many mappings (vm.max_map_count on Linux), so callers should bound the number
+ * of guarded contexts. If the guard page can not be set up anyway, the stack
+ * comes from malloc.
+ */
+static __inline__ LiteCtx *LiteCtx_alloc(size_t nbytes, int guard) {
+    size_t region_size = nbytes;
+    char *region = NULL;
+    char *stack = NULL;
+    int guarded = 0;
 #ifdef HAVE_SYS_MMAN_H
-    const int protect_err = mprotect(ptr, OVERFLOW_PADDING_SIZE, PROT_NONE);
-    if (protect_err != 0) {
-        perror("mprotect");
-        exit(1);
+    if (guard) {
+        const size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+        const size_t mapped_size = ((nbytes + page_size - 1) / page_size + 1) *
+            page_size;
+        char *mapped = (char *)mmap(NULL, mapped_size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANON, -1, 0);
+        if (mapped != MAP_FAILED) {
+            if (mprotect(mapped, page_size, PROT_NONE) == 0) {
+                region = mapped;
+                region_size = mapped_size;
+                stack = region + page_size;
+                guarded = 1;
+            } else {
+                munmap(mapped, mapped_size);
+            }
+        }
     }
 #endif
+    if (region == NULL) {
+        region = (char *)malloc(region_size);
+        if (!region) {
+            fprintf(stderr, "Failed allocating litectx\n");
+            exit(1);
+        }
+        stack = region;
+    }
 
-    printf("WARNING: Running in OVERFLOW_PROTECT mode to check for stack "
-            "overflows, this will negatively impact performance.\n");
-
-#ifdef HAVE_SYS_MMAN_H
-    printf("WARNING: Setting up PROT_NONE region at %p, length = %lu\n", ptr,
-            OVERFLOW_PADDING_SIZE);
-#endif
-
-    return ptr;
+    // Place the header at the top of the region, below which the stack grows
+    uintptr_t header = (uintptr_t)(region + region_size - sizeof(LiteCtx));
+    header &= ~((uintptr_t)63);
+    LiteCtx *ctx = (LiteCtx *)header;
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->_stack = stack;
+    ctx->_stack_size = (char *)ctx - stack;
+    ctx->_region = region;
+    ctx->_region_size = region_size;
+    ctx->_guarded = guarded;
+    return ctx;
 }
-#else
-#define LITECTX_ALLOC(nbytes) malloc(nbytes)
-#endif
 
-static __inline__ LiteCtx *LiteCtx_create(void (*fn)(LiteCtx*)) {
-    LiteCtx *ctx = (LiteCtx *)LITECTX_ALLOC(LITECTX_SIZE);
-    if (!ctx) {
-        fprintf(stderr, "Failed allocating litectx\n");
-        exit(1);
-    }
-    char *const stack_top = ctx->_stack + LITECTX_STACK_SIZE;
+/*
+ * Prepare ctx to start executing fn the next time it is swapped in.
+ */
+static __inline__ void LiteCtx_init(LiteCtx *ctx, void (*fn)(LiteCtx*)) {
+    char *const stack_top = ctx->_stack + ctx->_stack_size;
     ctx->prev = NULL;
     ctx->arg1 = NULL;
     ctx->arg2 = NULL;
-    ctx->_fctx = make_fcontext(stack_top, LITECTX_STACK_SIZE,
+    ctx->pool_next = NULL;
+    ctx->_fctx = make_fcontext(stack_top, ctx->_stack_size,
             (void (*)(void *))fn);
 
 #ifdef VERBOSE
-    fprintf(stderr, "LiteCtx_create: %p, ctx size = %lu, stack size = %lu, "
+    fprintf(stderr, "LiteCtx_init: %p, ctx size = %lu, stack size = %lu, "
             "stack top = %p, stack bottom = %p\n", ctx, sizeof(LiteCtx),
-            LITECTX_STACK_SIZE, stack_top, ctx->_stack);
+            ctx->_stack_size, stack_top, ctx->_stack);
 #endif
+}
+
+static __inline__ LiteCtx *LiteCtx_create(void (*fn)(LiteCtx*)) {
+    LiteCtx *ctx = LiteCtx_alloc(LITECTX_SIZE, 1);
+    LiteCtx_init(ctx, fn);
     return ctx;
 }
 
@@ -112,17 +145,16 @@ static __inline__ void LiteCtx_destroy(LiteCtx *ctx) {
     fprintf(stderr, "LiteCtx_destroy: ctx=%p\n", ctx);
 #endif
 
-#ifdef OVERFLOW_PROTECT
 #ifdef HAVE_SYS_MMAN_H
-    const int merr = mprotect(ctx, OVERFLOW_PADDING_SIZE,
-            PROT_READ | PROT_WRITE);
-    if (merr != 0) {
-        perror("mprotect");
-        exit(1);
+    if (ctx->_guarded) {
+        if (munmap(ctx->_region, ctx->_region_size) != 0) {
+            perror("munmap");
+            exit(1);
+        }
+        return;
     }
 #endif
-#endif
-    LITECTX_FREE(ctx);
+    free(ctx->_region);
 }
 
 /**
@@ -130,12 +162,12 @@ static __inline__ void LiteCtx_destroy(LiteCtx *ctx) {
  * stack (e.g., the original context of a pthread).
  */
 static __inline__ LiteCtx *LiteCtx_proxy_create(const char *lbl __attribute__((unused))) {
-    LiteCtx *ctx = (LiteCtx *)LITECTX_ALLOC(sizeof(*ctx));
-#ifdef OVERFLOW_PROTECT
-    memset(((unsigned char *)ctx) + OVERFLOW_PADDING_SIZE, 0, sizeof(*ctx) - OVERFLOW_PADDING_SIZE);
-#else
+    LiteCtx *ctx = (LiteCtx *)malloc(sizeof(*ctx));
+    if (!ctx) {
+        fprintf(stderr, "Failed allocating proxy litectx\n");
+        exit(1);
+    }
     memset(ctx, 0, sizeof(*ctx));
-#endif
 
 #ifdef VERBOSE
     fprintf(stderr, "LiteCtx_proxy_create[%s]: %p\n", lbl, ctx);
@@ -148,18 +180,7 @@ static __inline__ void LiteCtx_proxy_destroy(LiteCtx *ctx) {
     fprintf(stderr, "LiteCtx_proxy_destroy: ctx=%p\n", ctx);
 #endif
 
-#ifdef OVERFLOW_PROTECT
-#ifdef HAVE_SYS_MMAN_H
-    const int merr = mprotect(ctx, OVERFLOW_PADDING_SIZE,
-            PROT_READ | PROT_WRITE);
-    if (merr != 0) {
-        perror("mprotect");
-        exit(1);
-    }
-#endif
-#endif
-
-    LITECTX_FREE(ctx);
+    free(ctx);
 }
 
 /**
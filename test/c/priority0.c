@@ -0,0 +1,101 @@
+/* Copyright (c) 2013, Rice University
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+1.  Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+2.  Redistributions in binary form must reproduce the above
+     copyright notice, this list of conditions and the following
+     disclaimer in the documentation and/or other materials provided
+     with the distribution.
+3.  Neither the name of Rice University
+     nor the names of its contributors may be used to endorse or
+     promote products derived from this software without specific
+     prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+/**
+ * DESC: Fork asyncs of different priorities in a top-level loop. With a
+ * single worker, the prioritized ones have to run first.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+
+#include "hclib.h"
+
+#define NB_ASYNC 64
+#define NB_PRIORITY_ASYNC 8
+
+int ran[NB_ASYNC + NB_PRIORITY_ASYNC];
+int counter = 0;
+int nworkers = 0;
+
+void async_fct(void * arg) {
+    int idx = *((int *) arg);
+    assert(ran[idx] == -1);
+    ran[idx] = __sync_fetch_and_add(&counter, 1);
+}
+
+void entrypoint(void *arg) {
+    int i = 0;
+    int indices [NB_ASYNC + NB_PRIORITY_ASYNC];
+    for (i = 0; i < NB_ASYNC + NB_PRIORITY_ASYNC; i++) {
+        ran[i] = -1;
+        indices[i] = i;
+    }
+
+    hclib_start_finish();
+
+    for (i = 0; i < NB_ASYNC; i++) {
+        hclib_async(async_fct, (void*) (indices+i), NO_FUTURE, 0,
+                ANY_PLACE);
+    }
+    for (i = NB_ASYNC; i < NB_ASYNC + NB_PRIORITY_ASYNC; i++) {
+        hclib_async_with_priority(async_fct, (void*) (indices+i), NO_FUTURE,
+                0, ANY_PLACE, i % 2 ? HCLIB_PRIORITY_MAX : 1);
+    }
+
+    hclib_end_finish();
+    nworkers = hclib_get_num_workers();
+
+    printf("Call Finalize\n");
+}
+
+int main (int argc, char ** argv) {
+    printf("Call Init\n");
+    char const *deps[] = { "system" };
+    hclib_launch(entrypoint, NULL, deps, 1);
+    printf("Check results: ");
+    int i = 0;
+    for (i = 0; i < NB_ASYNC + NB_PRIORITY_ASYNC; i++) {
+        assert(ran[i] >= 0);
+    }
+    /*
+     * In work-first mode the default priority asyncs run as soon as they are
+     * spawned, before anything was queued.
+     */
+    const char *work_first = getenv("HCLIB_WORK_FIRST");
+    if (nworkers == 1 && !(work_first && atoi(work_first) != 0)) {
+        for (i = NB_ASYNC; i < NB_ASYNC + NB_PRIORITY_ASYNC; i++) {
+            assert(ran[i] < NB_PRIORITY_ASYNC);
+        }
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,92 @@
+/*
+ *  RICE University
+ *  Habanero Team
+ *
+ *  This file is part of HC Test.
+ *
+ */
+
+/*
+ * Root tasks submitted to an arena, from a task and from another thread, only
+ * run on the arena's workers, and bulk work never does.
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+
+#include "hclib_cpp.h"
+
+#define N_WORKERS 4
+#define N_REQUESTS 50
+#define N_BULK 1000
+
+static hclib::locale_t *arena = NULL;
+
+static int in_arena() {
+    return hclib::get_current_worker() >= 2;
+}
+
+static int fib(int n) {
+    assert(in_arena());
+    if (n < 2) return n;
+    hclib::future_t<int> *a = hclib::async_future([=] { return fib(n - 1); });
+    const int b = fib(n - 2);
+    return a->wait() + b;
+}
+
+static void request(int *result) {
+    hclib::finish([=] {
+        hclib::loop_domain_1d *loop = new hclib::loop_domain_1d(0, 8);
+        hclib::forasync1D(loop, [=](int i) { assert(in_arena()); }, false,
+                FORASYNC_MODE_RECURSIVE);
+    });
+    *result = fib(12);
+}
+
+static void *external_thread(void *arg) {
+    int i;
+    for (i = 0; i < N_REQUESTS; i++) {
+        int result = 0;
+        hclib::arena_submit(arena, [&] { request(&result); })->wait();
+        assert(result == 144);
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    const char *deps[] = { "system" };
+    const int arena_workers[] = { 2, 3 };
+    hclib::declare_arena("requests", arena_workers, 2);
+
+    hclib::launch(N_WORKERS, deps, 1, [] {
+        arena = hclib::get_arena("requests");
+        assert(arena && hclib::get_arena("batch") == NULL);
+
+        pthread_t thread;
+        assert(pthread_create(&thread, NULL, external_thread, NULL) == 0);
+
+        int results[N_REQUESTS];
+        hclib::future_t<void> *requests[N_REQUESTS];
+        hclib::finish([&] {
+            int i;
+            for (i = 0; i < N_REQUESTS; i++) {
+                int *result = results + i;
+                requests[i] = hclib::arena_submit(arena,
+                        [=] { request(result); });
+            }
+            for (i = 0; i < N_BULK; i++) {
+                hclib::async([] { assert(!in_arena()); });
+            }
+        });
+
+        int i;
+        for (i = 0; i < N_REQUESTS; i++) {
+            requests[i]->wait();
+            assert(results[i] == 144);
+        }
+        assert(pthread_join(thread, NULL) == 0);
+    });
+    printf("Check OK\n");
+    return 0;
+}
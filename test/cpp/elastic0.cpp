@@ -0,0 +1,170 @@
+/*
+ *  RICE University
+ *  Habanero Team
+ *
+ *  This file is part of HC Test.
+ *
+ */
+
+/*
+ * Changing the number of active workers between and during finish scopes,
+ * checking where tasks run once workers retired, and letting the load-based
+ * controller (HCLIB_ELASTIC_IDLE_US) retire idle workers and bring them back.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hclib_cpp.h"
+
+#define N_ROUNDS 20
+#define N_ASYNCS 200
+#define N_BURST_ASYNCS 4000
+// How long to wait for the elastic controller, in milliseconds
+#define ELASTIC_TIMEOUT_MS 5000
+
+static void spin(int iters) {
+    volatile int i;
+    for (i = 0; i < iters; i++) ;
+}
+
+static void atomic_max(volatile int *max, int val) {
+    int curr = *max;
+    while (val > curr && !__sync_bool_compare_and_swap(max, curr, val)) {
+        curr = *max;
+    }
+}
+
+/*
+ * The locale only worker wid pops and steals from in the default locality
+ * graph, see generate_locality_info.
+ */
+static hclib::locale_t *worker_locale(int wid) {
+    char lbl[32];
+    sprintf(lbl, "L1%d", wid);
+    hclib::locale_t *locales = hclib::get_all_locales();
+    int i;
+    for (i = 0; i < hclib::get_num_locales(); i++) {
+        if (strcmp(locales[i].lbl, lbl) == 0) return locales + i;
+    }
+    assert(false);
+    return NULL;
+}
+
+static int fib(int n) {
+    if (n < 2) return n;
+    hclib::future_t<int> *a = hclib::async_future([=] { return fib(n - 1); });
+    const int b = fib(n - 2);
+    return a->wait() + b;
+}
+
+int main(int argc, char **argv) {
+    setenv("HCLIB_ELASTIC_IDLE_US", "1000", 1);
+    // Spawned tasks only pile up on a worker when they are not run work-first
+    setenv("HCLIB_WORK_FIRST", "0", 1);
+    // Uses the default locality graph, see worker_locale
+    unsetenv("HCLIB_LOCALITY_FILE");
+
+    const char *deps[] = { "system" };
+    hclib::launch(deps, 1, [] {
+        const int nworkers = hclib::get_num_workers();
+        int round;
+
+        for (round = 0; round < N_ROUNDS; round++) {
+            hclib::set_num_active_workers(round % nworkers + 1);
+            assert(hclib::get_num_active_workers() <= round % nworkers + 1);
+
+            int count = 0;
+            hclib::finish([&] {
+                int i;
+                for (i = 0; i < N_ASYNCS; i++) {
+                    hclib::async([&, i] {
+                        if (i % 50 == 0) {
+                            hclib::set_num_active_workers(
+                                    (i / 50) % nworkers + 1);
+                        }
+                        __sync_fetch_and_add(&count, 1);
+                    });
+                }
+            });
+            assert(count == N_ASYNCS);
+            assert(fib(12) == 144);
+        }
+
+        int nactive;
+        for (nactive = 1; nactive < nworkers; nactive++) {
+            hclib::set_num_active_workers(nactive);
+            // Let retired workers finish any steal they were in the middle of
+            usleep(10000);
+
+            /*
+             * Retired workers take no tasks, except for the one running this
+             * task, which keeps running the tasks it spawned while it waits.
+             */
+            const int me = hclib::get_current_worker();
+            int count = 0;
+            hclib::finish([&] {
+                int i;
+                for (i = 0; i < N_ASYNCS; i++) {
+                    hclib::async([&] {
+                        const int wid = hclib::get_current_worker();
+                        assert(wid < nactive || wid == me);
+                        spin(1000);
+                        __sync_fetch_and_add(&count, 1);
+                    });
+                }
+            });
+            assert(count == N_ASYNCS);
+
+            // Tasks at a locale only a retired worker takes care of still run
+            const int retired = nworkers - 1;
+            count = 0;
+            hclib::finish([&] {
+                int i;
+                for (i = 0; i < N_ASYNCS; i++) {
+                    hclib::async_at([&] {
+                        assert(hclib::get_current_worker() == retired);
+                        __sync_fetch_and_add(&count, 1);
+                    }, worker_locale(retired));
+                }
+            });
+            assert(count == N_ASYNCS);
+        }
+
+        hclib::set_num_active_workers(nworkers);
+        if (nworkers > 1) {
+            // Idle workers retire on their own
+            int waited;
+            for (waited = 0; waited < ELASTIC_TIMEOUT_MS &&
+                    hclib::get_num_active_workers() == nworkers; waited++) {
+                usleep(1000);
+            }
+            const int shrunk = hclib::get_num_active_workers();
+            assert(shrunk < nworkers);
+
+            // And come back once tasks pile up
+            volatile int max_active = shrunk;
+            int count = 0;
+            hclib::finish([&] {
+                hclib::async([&] {
+                    int i;
+                    for (i = 0; i < N_BURST_ASYNCS; i++) {
+                        hclib::async([&] {
+                            atomic_max(&max_active,
+                                    hclib::get_num_active_workers());
+                            spin(10000);
+                            __sync_fetch_and_add(&count, 1);
+                        });
+                    }
+                });
+            });
+            assert(count == N_BURST_ASYNCS);
+            assert(max_active > shrunk);
+        }
+    });
+    printf("Check OK\n");
+    return 0;
+}
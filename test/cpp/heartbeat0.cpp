@@ -0,0 +1,99 @@
+/*
+ *  RICE University
+ *  Habanero Team
+ *
+ *  This file is part of HC Test.
+ *
+ */
+
+/*
+ * Heartbeat mode (HCLIB_HEARTBEAT_US): spawned tasks stay latent on their
+ * worker until promoted. Every task of a deep recursive workload still runs,
+ * and a handful of long tasks spawned by one worker, which only other workers
+ * can run once they have been promoted, is spread across workers.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "hclib_cpp.h"
+
+#define N_WORKERS 4
+#define TREE_DEPTH 16
+#define CHAIN_LENGTH 10000
+#define N_LONG_TASKS 16
+
+static int ran_on[N_WORKERS];
+
+static void spin(int iters) {
+    volatile int i;
+    for (i = 0; i < iters; i++) ;
+}
+
+static int n_workers_used() {
+    int i, n = 0;
+    for (i = 0; i < N_WORKERS; i++) {
+        if (ran_on[i] > 0) n++;
+        ran_on[i] = 0;
+    }
+    return n;
+}
+
+static void tree(int depth, int *count) {
+    __sync_fetch_and_add(count, 1);
+    if (depth == 0) return;
+    hclib::async([=] { tree(depth - 1, count); });
+    hclib::async([=] { tree(depth - 1, count); });
+}
+
+static void chain(int remaining, int *count) {
+    __sync_fetch_and_add(count, 1);
+    if (remaining == 0) return;
+    hclib::async([=] { chain(remaining - 1, count); });
+}
+
+static int fib(int n) {
+    if (n < 2) return n;
+    hclib::future_t<int> *a = hclib::async_future([=] { return fib(n - 1); });
+    const int b = fib(n - 2);
+    return a->wait() + b;
+}
+
+int main(int argc, char **argv) {
+    setenv("HCLIB_HEARTBEAT_US", "10", 1);
+
+    const char *deps[] = { "system" };
+    hclib::launch(N_WORKERS, deps, 1, [] {
+        int count = 0;
+        hclib::finish([&] {
+            tree(TREE_DEPTH, &count);
+        });
+        assert(count == (1 << (TREE_DEPTH + 1)) - 1);
+
+        count = 0;
+        hclib::finish([&] {
+            chain(CHAIN_LENGTH, &count);
+        });
+        assert(count == CHAIN_LENGTH + 1);
+
+        assert(fib(22) == 17711);
+
+        count = 0;
+        hclib::finish([&] {
+            int i;
+            for (i = 0; i < N_LONG_TASKS; i++) {
+                hclib::async([&] {
+                    __sync_fetch_and_add(ran_on + hclib::get_current_worker(),
+                        1);
+                    spin(1000000);
+                    __sync_fetch_and_add(&count, 1);
+                });
+            }
+        });
+        assert(count == N_LONG_TASKS);
+        assert(n_workers_used() > 1);
+    });
+    printf("Check OK\n");
+    return 0;
+}
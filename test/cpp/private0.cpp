@@ -0,0 +1,107 @@
+/*
+ *  RICE University
+ *  Habanero Team
+ *
+ *  This file is part of HC Test.
+ *
+ */
+
+/*
+ * Private deques (HCLIB_PRIVATE_DEQUES=1): tasks spawned by one worker, with
+ * and without a priority, are still stolen by the others through the steal
+ * mailbox, and tasks released by puts run as well.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "hclib_cpp.h"
+
+#define N_WORKERS 4
+#define N_ASYNCS 1000
+#define N_WAITERS 200
+
+static int ran_on[N_WORKERS];
+
+static void spin(int iters) {
+    volatile int i;
+    for (i = 0; i < iters; i++) ;
+}
+
+static void record_worker() {
+    __sync_fetch_and_add(ran_on + hclib::get_current_worker(), 1);
+}
+
+static int n_workers_used() {
+    int i, n = 0;
+    for (i = 0; i < N_WORKERS; i++) {
+        if (ran_on[i] > 0) n++;
+        ran_on[i] = 0;
+    }
+    return n;
+}
+
+static int fib(int n) {
+    if (n < 2) return n;
+    hclib::future_t<int> *a = hclib::async_future([=] { return fib(n - 1); });
+    const int b = fib(n - 2);
+    return a->wait() + b;
+}
+
+int main(int argc, char **argv) {
+    setenv("HCLIB_PRIVATE_DEQUES", "1", 1);
+
+    const char *deps[] = { "system" };
+    hclib::launch(N_WORKERS, deps, 1, [] {
+        int count = 0;
+        hclib::finish([&] {
+            int i;
+            for (i = 0; i < N_ASYNCS; i++) {
+                hclib::async([&] {
+                    record_worker();
+                    spin(10000);
+                    __sync_fetch_and_add(&count, 1);
+                });
+            }
+        });
+        assert(count == N_ASYNCS);
+        assert(n_workers_used() > 1);
+
+        count = 0;
+        hclib::finish([&] {
+            int i;
+            for (i = 0; i < N_ASYNCS; i++) {
+                hclib::async_with_priority(i % (HCLIB_PRIORITY_MAX + 1), [&] {
+                    record_worker();
+                    spin(10000);
+                    __sync_fetch_and_add(&count, 1);
+                });
+            }
+        });
+        assert(count == N_ASYNCS);
+        assert(n_workers_used() > 1);
+
+        count = 0;
+        hclib::promise_t<int> *promise = new hclib::promise_t<int>();
+        hclib::finish([&] {
+            int i;
+            for (i = 0; i < N_WAITERS; i++) {
+                hclib::async_await([&] {
+                    assert(promise->get_future()->get() == 42);
+                    record_worker();
+                    spin(100000);
+                    __sync_fetch_and_add(&count, 1);
+                }, promise->get_future());
+            }
+            hclib::async([=] { promise->put(42); });
+        });
+        assert(count == N_WAITERS);
+        assert(n_workers_used() > 1);
+        delete promise;
+
+        assert(fib(20) == 6765);
+    });
+    printf("Check OK\n");
+    return 0;
+}
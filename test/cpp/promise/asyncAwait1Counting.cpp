@@ -0,0 +1,72 @@
+/*
+ *  RICE University
+ *  Habanero Team
+ *
+ *  This file is part of HC Test.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+
+#include <vector>
+
+#include "hclib_cpp.h"
+
+/*
+ * async_await on several futures in dependency counting mode, with some of
+ * them already satisfied when the task is spawned and the others put on
+ * concurrently.
+ */
+
+#define N_FUTURES 12
+#define N_WAITERS 8
+#define N_ROUNDS 200
+
+int main(int argc, char ** argv) {
+    setenv("HCLIB_DEPENDENCY_COUNTING", "1", 1);
+
+    const char *deps[] = { "system" };
+    hclib::launch(deps, 1, [=]() {
+        int round;
+        for (round = 0; round < N_ROUNDS; round++) {
+            hclib::promise_t<int> promises[N_FUTURES];
+            std::vector<hclib_future_t *> futures;
+            int i;
+            for (i = 0; i < N_FUTURES; i++) {
+                futures.push_back(promises[i].get_future());
+            }
+            // Satisfy some of them before anybody waits
+            for (i = 0; i < N_FUTURES; i += 5) {
+                promises[i].put(i);
+            }
+
+            int ran = 0;
+            int *ran_ptr = &ran;
+            hclib::finish([&] {
+                int w;
+                for (w = 0; w < N_WAITERS; w++) {
+                    hclib::async_await([=] {
+                        int j;
+                        for (j = 0; j < N_FUTURES; j++) {
+                            assert(((hclib::future_t<int> *)futures[j])->get()
+                                    == j);
+                        }
+                        __sync_fetch_and_add(ran_ptr, 1);
+                    }, futures);
+                }
+
+                for (i = 0; i < N_FUTURES; i++) {
+                    if (i % 5 != 0) {
+                        hclib::promise_t<int> *p = promises + i;
+                        hclib::async([=] { p->put(i); });
+                    }
+                }
+            });
+            assert(ran == N_WAITERS);
+        }
+    });
+    printf("Check OK\n");
+    return 0;
+}
@@ -0,0 +1,107 @@
+/*
+ *  RICE University
+ *  Habanero Team
+ *
+ *  This file is part of HC Test.
+ *
+ */
+
+/*
+ * A single put releasing more waiters than fit in one batch, with groups of
+ * them bound to different locales and priorities. Every waiter runs once and
+ * on its own locale, and those in the arena run in priority order.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+
+#include "hclib_cpp.h"
+
+#define N_WORKERS 2
+#define ARENA_WORKER 1
+#define GROUP_SIZE 8
+#define N_GROUPS 24
+#define N_WAITERS (GROUP_SIZE * N_GROUPS)
+
+static hclib::locale_t *arena = NULL;
+static hclib::locale_t *master = NULL;
+
+static int ran[N_WAITERS];
+static int arena_order[N_WAITERS];
+static int n_arena_ran = 0;
+
+static int in_arena(const int group) {
+    return group % 2 == 0;
+}
+
+/*
+ * Arena workers give the default lane a turn after HCLIB_PRIORITY_BURST
+ * priority tasks in a row, so keep fewer than that in the arena. These are
+ * the last groups to wait, so that they are released first and would run
+ * last without their lanes.
+ */
+static int group_priority(const int group) {
+    if (in_arena(group)) {
+        switch (N_GROUPS - group) {
+            case 4: return HCLIB_PRIORITY_MAX;
+            case 2: return HCLIB_PRIORITY_MAX - 1;
+            default: return HCLIB_PRIORITY_DEFAULT;
+        }
+    }
+    return (group / 2) % HCLIB_NUM_PRIORITIES;
+}
+
+int main(int argc, char **argv) {
+    const char *deps[] = { "system" };
+    const int arena_workers[] = { ARENA_WORKER };
+    hclib::declare_arena("waiters", arena_workers, 1);
+
+    hclib::launch(N_WORKERS, deps, 1, [] {
+        arena = hclib::get_arena("waiters");
+        master = hclib_get_master_place();
+        assert(arena && master != arena);
+
+        hclib::promise_t<int> *promise = new hclib::promise_t<int>();
+        int n_arena = 0;
+        hclib::finish([&] {
+            int i;
+            for (i = 0; i < N_WAITERS; i++) {
+                const int group = i / GROUP_SIZE;
+                if (in_arena(group)) n_arena++;
+                hclib::async_await_at_with_priority(group_priority(group), [=] {
+                    assert(promise->get_future()->get() == 42);
+                    if (in_arena(group)) {
+                        assert(hclib::get_current_worker() == ARENA_WORKER);
+                        arena_order[n_arena_ran++] = group_priority(group);
+                    } else {
+                        assert(hclib::get_current_worker() != ARENA_WORKER);
+                    }
+                    __sync_fetch_and_add(ran + i, 1);
+                }, promise->get_future(), in_arena(group) ? arena : master);
+            }
+
+            /*
+             * Put from the arena's only worker, which can not run anything
+             * else until we are done. Other tasks may already be queued
+             * there, such as our continuation in work-first mode.
+             */
+            hclib::arena_submit(arena, [=] {
+                const unsigned queued = locale_num_tasks(arena);
+                promise->put(42);
+                assert(locale_num_tasks(arena) - queued == (unsigned)n_arena);
+            })->wait();
+        });
+
+        int i;
+        for (i = 0; i < N_WAITERS; i++) {
+            assert(ran[i] == 1);
+        }
+        assert(n_arena_ran == n_arena);
+        for (i = 1; i < n_arena; i++) {
+            assert(arena_order[i] <= arena_order[i - 1]);
+        }
+        delete promise;
+    });
+    printf("Check OK\n");
+    return 0;
+}
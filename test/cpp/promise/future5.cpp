@@ -53,18 +53,24 @@ int main(int argc, char **argv) {
 
         volatile bool put_all = false;
 
-        hclib::async_await([&] {
-            assert(put_all);
-        }, futures);
+        /*
+         * The waiter captures locals of this task by reference, so it must
+         * complete before they go out of scope.
+         */
+        hclib::finish([&] {
+            hclib::async_await([&] {
+                assert(put_all);
+            }, futures);
 
-        usleep(500000);
+            usleep(500000);
 
-        for (unsigned i = 0; i < futures.size() - 1; i++) {
-            promises.at(i)->put();
-        }
+            for (unsigned i = 0; i < futures.size() - 1; i++) {
+                promises.at(i)->put();
+            }
 
-        put_all = true;
-        promises.at(futures.size() - 1)->put();
+            put_all = true;
+            promises.at(futures.size() - 1)->put();
+        });
     });
 
     printf("OK\n");
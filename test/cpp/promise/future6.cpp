@@ -0,0 +1,68 @@
+/*
+ *  RICE University
+ *  Habanero Team
+ *
+ *  This file is part of HC Test.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <utility>
+#include <vector>
+
+#include "hclib_cpp.h"
+
+/*
+ * Futures of values that do not fit in a pointer are stored inline in their
+ * promise, constructed on put and destroyed with the promise.
+ */
+
+struct point {
+    double x, y, z;
+};
+
+static int n_live = 0;
+
+struct counted {
+    int val;
+    counted(int v) : val(v) { n_live++; }
+    counted(const counted &other) : val(other.val) { n_live++; }
+    counted(counted &&other) : val(other.val) { n_live++; }
+    ~counted() { n_live--; }
+};
+
+int main(int argc, char ** argv) {
+    const char *deps[] = { "system" };
+    hclib::launch(deps, 1, [=]() {
+        hclib::future_t<point> *p = hclib::async_future([] {
+            point res = { 1.0, 2.0, 3.0 };
+            return res;
+        });
+        hclib::future_t<std::pair<long, long>> *pair =
+            hclib::async_future([] { return std::make_pair(4L, 5L); });
+        hclib::future_t<std::vector<int>> *vec = hclib::async_future_await(
+                [=] {
+                    std::vector<int> res(3, (int)p->get().z);
+                    return res;
+                }, p);
+
+        point pt = p->wait();
+        assert(pt.x == 1.0 && pt.y == 2.0 && pt.z == 3.0);
+        std::pair<long, long> pr = pair->wait();
+        assert(pr.first == 4 && pr.second == 5);
+        std::vector<int> v = vec->wait();
+        assert(v.size() == 3 && v[0] == 3 && v[2] == 3);
+
+        {
+            hclib::promise_t<counted> promise;
+            promise.put(counted(7));
+            assert(n_live == 1);
+            assert(promise.get_future()->get().val == 7);
+        }
+        assert(n_live == 0);
+    });
+    printf("Check OK\n");
+    return 0;
+}
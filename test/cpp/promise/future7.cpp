@@ -0,0 +1,68 @@
+/*
+ *  RICE University
+ *  Habanero Team
+ *
+ *  This file is part of HC Test.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+
+#include "hclib_cpp.h"
+
+/*
+ * Promises created by async_future are released once their producer put on
+ * them and the last future_ref_t to them is gone.
+ */
+
+#define N_ROUNDS 1000
+
+static int n_live = 0;
+
+struct counted {
+    int val;
+    counted(int v) : val(v) { __sync_fetch_and_add(&n_live, 1); }
+    counted(const counted &other) : val(other.val) {
+        __sync_fetch_and_add(&n_live, 1);
+    }
+    ~counted() { __sync_fetch_and_sub(&n_live, 1); }
+    char padding[32];
+};
+
+static void *c_future(void *arg) {
+    return arg;
+}
+
+int main(int argc, char ** argv) {
+    const char *deps[] = { "system" };
+    hclib::launch(deps, 1, [=]() {
+        int i;
+        for (i = 0; i < N_ROUNDS; i++) {
+            hclib::future_ref_t<counted> a = hclib::async_future([=] {
+                return counted(i);
+            });
+            hclib::future_ref_t<counted> b = a;
+            hclib::finish([=] {
+                hclib::async_await([=] {
+                    assert(b->get().val == i);
+                }, b.get_future());
+            });
+            a->wait();
+        }
+
+        hclib::future_ref_t<void> done = hclib::nonblocking_finish([] {
+            hclib::async([] { });
+        });
+        done->wait();
+
+        hclib_future_t *c = hclib_async_future(c_future, &n_live, NULL, 0,
+                NULL);
+        assert(hclib_future_wait(c) == &n_live);
+        hclib_future_release(c);
+    });
+    assert(n_live == 0);
+    printf("Check OK\n");
+    return 0;
+}
@@ -0,0 +1,79 @@
+/*
+ *  RICE University
+ *  Habanero Team
+ *
+ *  This file is part of HC Test.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+
+#include <vector>
+
+#include "hclib_cpp.h"
+
+/*
+ * when_all and when_any over futures that are pending, already satisfied, or
+ * a mix of both. Few pending futures fit a slab block along with the
+ * combined promise, many do not.
+ */
+
+#define MAX_FUTURES 16
+#define N_ROUNDS 100
+
+static void combine(const int nfutures) {
+    hclib::promise_t<int> promises[MAX_FUTURES];
+    std::vector<hclib_future_t *> futures;
+    int i;
+    for (i = 0; i < nfutures; i++) {
+        futures.push_back(promises[i].get_future());
+    }
+    // Satisfy some of them up front
+    for (i = 0; i < nfutures; i += 4) {
+        promises[i].put(i);
+    }
+
+    hclib::future_ref_t<void> all = hclib::when_all(futures);
+    hclib::future_ref_t<hclib_future_t *> any = hclib::when_any(
+            futures.data() + 1, nfutures - 1);
+    assert(!all->test());
+
+    hclib::finish([&] {
+        for (i = 0; i < nfutures; i++) {
+            if (i % 4 != 0) {
+                hclib::promise_t<int> *p = promises + i;
+                hclib::async([=] { p->put(i); });
+            }
+        }
+    });
+
+    all->wait();
+    hclib_future_t *first = any->get();
+    assert(first != futures[0]);
+    for (i = 1; futures[i] != first; i++) ;
+    assert(((hclib::future_t<int> *)first)->get() == i);
+
+    // Everything is satisfied by now
+    hclib::future_ref_t<void> all_done = hclib::when_all(futures);
+    assert(all_done->test());
+    hclib::future_ref_t<hclib_future_t *> any_done = hclib::when_any(futures);
+    assert(any_done->get() == futures[0]);
+}
+
+int main(int argc, char ** argv) {
+    const char *deps[] = { "system" };
+    hclib::launch(deps, 1, [=]() {
+        int round;
+        for (round = 0; round < N_ROUNDS; round++) {
+            combine(4);
+            combine(MAX_FUTURES);
+        }
+
+        hclib::future_ref_t<void> none = hclib::when_all(NULL, 0);
+        assert(none->test());
+    });
+    printf("Check OK\n");
+    return 0;
+}
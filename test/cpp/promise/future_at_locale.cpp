@@ -0,0 +1,90 @@
+/*
+ *  RICE University
+ *  Habanero Team
+ *
+ *  This file is part of HC Test.
+ *
+ */
+
+/*
+ * A worker waiting on a future does not run its producer itself if the
+ * producer was placed at a locale the worker does not pop from. L2_1 is only
+ * on worker 1's paths, so producers placed there always run on worker 1, even
+ * though worker 0 waits on them.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hclib_cpp.h"
+
+#define N_FUTURES 100
+
+static const char *locality =
+    "{\n"
+    "    \"nworkers\": 2,\n"
+    "    \"declarations\": [ \"sysmem\", \"L2_0\", \"L2_1\" ],\n"
+    "    \"reachability\": [ [\"sysmem\", \"L2_0\"], [\"sysmem\", \"L2_1\"] ],\n"
+    "    \"pop_paths\": {\n"
+    "        \"default\": [\"sysmem\"],\n"
+    "        0: [\"L2_0\", \"sysmem\"],\n"
+    "        1: [\"L2_1\", \"sysmem\"]\n"
+    "    },\n"
+    "    \"steal_paths\": {\n"
+    "        \"default\": [\"sysmem\"],\n"
+    "        0: [\"L2_0\", \"sysmem\"],\n"
+    "        1: [\"L2_1\", \"sysmem\"]\n"
+    "    }\n"
+    "}\n";
+
+static hclib::locale_t *find_locale(const char *lbl) {
+    hclib::locale_t *locales = hclib::get_all_locales();
+    int i;
+    for (i = 0; i < hclib::get_num_locales(); i++) {
+        if (strcmp(locales[i].lbl, lbl) == 0) return locales + i;
+    }
+    assert(false);
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    char filename[] = "/tmp/future_at_locale.XXXXXX";
+    const int fd = mkstemp(filename);
+    assert(fd >= 0);
+    const ssize_t written = write(fd, locality, strlen(locality));
+    assert(written == (ssize_t)strlen(locality));
+    close(fd);
+    setenv("HCLIB_LOCALITY_FILE", filename, 1);
+    // Worker 1 has to exist
+    unsetenv("HCLIB_WORKERS");
+
+    const char *deps[] = { "system" };
+    hclib::launch(deps, 1, [] {
+        hclib::locale_t *l2_0 = find_locale("L2_0");
+        hclib::locale_t *l2_1 = find_locale("L2_1");
+
+        hclib::finish([=] {
+            hclib::async_at([=] {
+                assert(hclib::get_current_worker() == 0);
+                int i;
+                for (i = 0; i < N_FUTURES; i++) {
+                    hclib::future_t<int> *f = hclib::async_future_at([=] {
+                        return hclib::get_current_worker();
+                    }, l2_1);
+                    assert(f->wait() == 1);
+
+                    hclib::future_t<int> *nb = hclib::async_nb_future_at([=] {
+                        return hclib::get_current_worker();
+                    }, l2_1);
+                    assert(nb->wait() == 1);
+                }
+            }, l2_0);
+        });
+    });
+    unlink(filename);
+    printf("Check OK\n");
+    return 0;
+}
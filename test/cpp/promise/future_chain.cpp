@@ -0,0 +1,40 @@
+/*
+ *  RICE University
+ *  Habanero Team
+ *
+ *  This file is part of HC Test.
+ *
+ */
+
+/*
+ * A long chain of futures, each of whose producers waits on the previous one.
+ * Waiting on the last one runs producers inline, nested on the waiter's stack,
+ * until there is no room left there and it has to suspend instead.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "hclib_cpp.h"
+
+#define CHAIN_LENGTH 10000
+
+int main(int argc, char **argv) {
+    const char *deps[] = { "system" };
+    hclib::launch(deps, 1, [] {
+        hclib::future_t<int> **f = new hclib::future_t<int> *[CHAIN_LENGTH];
+        hclib::finish([=] {
+            f[0] = hclib::async_future([] { return 0; });
+            int i;
+            for (i = 1; i < CHAIN_LENGTH; i++) {
+                hclib::future_t<int> *prev = f[i - 1];
+                f[i] = hclib::async_future([=] { return prev->wait() + 1; });
+            }
+            assert(f[CHAIN_LENGTH - 1]->wait() == CHAIN_LENGTH - 1);
+        });
+        delete[] f;
+    });
+    printf("Check OK\n");
+    return 0;
+}
@@ -0,0 +1,68 @@
+/*
+ *  RICE University
+ *  Habanero Team
+ *
+ *  This file is part of HC Test.
+ *
+ */
+
+/*
+ * Root tasks submitted to the runtime in service mode from several threads,
+ * across a restart of the runtime.
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+
+#include "hclib_cpp.h"
+
+#define N_THREADS 4
+#define N_RUNS 50
+
+static int fib(int n) {
+    if (n < 2) return n;
+    hclib::future_t<int> *a = hclib::async_future([=] { return fib(n - 1); });
+    const int b = fib(n - 2);
+    return a->wait() + b;
+}
+
+static void *client(void *arg) {
+    int i;
+    for (i = 0; i < N_RUNS; i++) {
+        int result = 0;
+        hclib::service_run([&] {
+            hclib::async([&] { result = fib(10); });
+        });
+        assert(result == 55);
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    const char *deps[] = { "system" };
+    int round, i;
+
+    for (round = 0; round < 2; round++) {
+        hclib::service_start(deps, 1);
+
+        pthread_t threads[N_THREADS];
+        for (i = 0; i < N_THREADS; i++) {
+            assert(pthread_create(threads + i, NULL, client, NULL) == 0);
+        }
+        for (i = 0; i < N_THREADS; i++) {
+            assert(pthread_join(threads[i], NULL) == 0);
+        }
+
+        // Left for hclib_service_stop to wait for
+        int count = 0;
+        for (i = 0; i < N_RUNS; i++) {
+            hclib::service_submit([&] { __sync_fetch_and_add(&count, 1); });
+        }
+        hclib::service_stop();
+        assert(count == N_RUNS);
+        printf("Round %d done\n", round);
+    }
+    printf("Check OK\n");
+    return 0;
+}
@@ -0,0 +1,57 @@
+/*
+ *  RICE University
+ *  Habanero Team
+ *
+ *  This file is part of HC Test.
+ *
+ */
+
+/*
+ * Tasks submitted by a thread that is not an HClib worker, which waits on
+ * their futures and signals the runtime through a promise.
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+
+#include "hclib_cpp.h"
+
+#define N_SUBMITS 100
+
+static void *square(void *arg) {
+    long i = (long)arg;
+    return (void *)(i * i);
+}
+
+static void *external_thread(void *arg) {
+    hclib::promise_t<long> *done = (hclib::promise_t<long> *)arg;
+    hclib_future_t *futures[N_SUBMITS];
+    long sum = 0;
+    long i;
+
+    for (i = 0; i < N_SUBMITS; i++) {
+        futures[i] = hclib_submit(square, (void *)i, NULL);
+    }
+    for (i = 0; i < N_SUBMITS; i++) {
+        sum += (long)hclib_future_wait(futures[i]);
+    }
+    done->put(sum);
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    const char *deps[] = { "system" };
+    hclib::launch(deps, 1, [] {
+        hclib::promise_t<long> *done = new hclib::promise_t<long>();
+        pthread_t thread;
+        assert(pthread_create(&thread, NULL, external_thread, done) == 0);
+
+        const long sum = done->get_future()->wait();
+        assert(sum == (long)(N_SUBMITS - 1) * N_SUBMITS * (2 * N_SUBMITS - 1) / 6);
+        assert(pthread_join(thread, NULL) == 0);
+        printf("Sum of squares = %ld\n", sum);
+    });
+    printf("Check OK\n");
+    return 0;
+}
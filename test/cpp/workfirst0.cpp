@@ -0,0 +1,88 @@
+/*
+ *  RICE University
+ *  Habanero Team
+ *
+ *  This file is part of HC Test.
+ *
+ */
+
+/*
+ * Work-first mode (HCLIB_WORK_FIRST=1): on a single worker, spawned tasks run
+ * as soon as they are spawned, so a recursive workload runs in the order of
+ * its sequential elision. Spawning deeper than HCLIB_WORK_FIRST_MAX_DEPTH
+ * falls back to help-first and still completes.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "hclib_cpp.h"
+
+#define TREE_DEPTH 6
+#define MAX_EVENTS (4 << TREE_DEPTH)
+// Well past HCLIB_WORK_FIRST_MAX_DEPTH
+#define CHAIN_LENGTH 2000
+
+static int parallel_events[MAX_EVENTS];
+static int sequential_events[MAX_EVENTS];
+static int n_parallel_events = 0;
+static int n_sequential_events = 0;
+
+/*
+ * Records entering node id as id, and leaving it as -id - 1. When parallel is
+ * false, children are called directly instead of being spawned.
+ */
+static void tree(int depth, int id, bool parallel) {
+    int *events = parallel ? parallel_events : sequential_events;
+    int *n_events = parallel ? &n_parallel_events : &n_sequential_events;
+
+    assert(*n_events < MAX_EVENTS);
+    events[(*n_events)++] = id;
+    if (depth > 0) {
+        if (parallel) {
+            hclib::async([=] { tree(depth - 1, 2 * id + 1, true); });
+            hclib::async([=] { tree(depth - 1, 2 * id + 2, true); });
+        } else {
+            tree(depth - 1, 2 * id + 1, false);
+            tree(depth - 1, 2 * id + 2, false);
+        }
+    }
+    assert(*n_events < MAX_EVENTS);
+    events[(*n_events)++] = -id - 1;
+}
+
+static void chain(int remaining, int *count) {
+    (*count)++;
+    if (remaining == 0) return;
+    hclib::async([=] { chain(remaining - 1, count); });
+}
+
+int main(int argc, char **argv) {
+    setenv("HCLIB_WORK_FIRST", "1", 1);
+
+    const char *deps[] = { "system" };
+    hclib::launch(1, deps, 1, [] {
+        hclib::finish([] {
+            hclib::async([] {
+                tree(TREE_DEPTH, 0, false);
+                hclib::finish([] {
+                    tree(TREE_DEPTH, 0, true);
+                });
+                assert(n_parallel_events == n_sequential_events);
+                int i;
+                for (i = 0; i < n_sequential_events; i++) {
+                    assert(parallel_events[i] == sequential_events[i]);
+                }
+
+                int count = 0;
+                hclib::finish([&] {
+                    chain(CHAIN_LENGTH, &count);
+                });
+                assert(count == CHAIN_LENGTH + 1);
+            });
+        });
+    });
+    printf("Check OK\n");
+    return 0;
+}
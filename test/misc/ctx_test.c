@@ -49,7 +49,7 @@ LiteCtx* makeCtx(void (*fn)(LiteCtx*), const char* fn_str) {
   
   printf("Created context for %s: %p\n", fn_str, ctx);
   printf("  fctx: %p\n", ctx->_fctx);
-  char *const stack_top = ctx->_stack + LITECTX_STACK_SIZE;
+  char *const stack_top = ctx->_stack + ctx->_stack_size;
   printf("  stack: %p-%p\n",ctx->_stack, stack_top);
   
   ctx->arg1 = (void *)fn_str;